@@ -3,6 +3,8 @@ cd "$(dirname "$0")"
 cd lib
 ld -r -b binary -o all_res.o all.res
 cd ..
-g++ main.cpp -o testris -lGL -lGLEW -lglfw lib/all_res.o
-g++ -g main.cpp -o testris_dbg -lGL -lGLEW -lglfw lib/all_res.o
+g++ main.cpp -o testris -lGL -lGLEW -lglfw -lpthread lib/all_res.o
+g++ -g main.cpp -o testris_dbg -lGL -lGLEW -lglfw -lpthread lib/all_res.o
+g++ -O2 testris_batch.cpp -o testris_batch -lpthread
+g++ -O2 testris_replay.cpp -o testris_replay
 rm lib/all_res.o
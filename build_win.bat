@@ -8,3 +8,7 @@ dumpbin /symbols lib\all_res.lib
 
 cl main.cpp /Fe:testris.exe /MD /I lib\include\ /link /SUBSYSTEM:WINDOWS /LIBPATH:lib all_res.lib glfw3.lib glew32s.lib opengl32.lib user32.lib gdi32.lib shell32.lib winmm.lib
 
+cl testris_batch.cpp /O2 /EHsc /Fe:testris_batch.exe /MD
+
+cl testris_replay.cpp /O2 /EHsc /Fe:testris_replay.exe /MD
+
@@ -343,8 +343,10 @@ char *CLAGetFirstArg(int argc, char **argv) {
 
 u64 ReadSystemTimerMySec();
 u32 ReadSystemTimerMySec32();
+u64 ReadMonotonicTimerMySec(); // never jumps with wall clock changes, for measuring intervals
 u64 ReadCPUTimer();
 void XSleep(u32 ms);
+void XSleepMySec(u64 mys);
 
 
 #if PROFILE == 1 // enable profiler
@@ -2515,6 +2517,7 @@ void WriteRandomHexStr(char* dest, int nhexchars, bool put_newline_and_nullchar
 
 
 void XSleep(u32 ms);
+void XSleepMySec(u64 mys);
 
 
 //
@@ -2772,7 +2775,7 @@ const char *getBuild() { // courtesy of S.O.
             u64 systime;
             struct timeval tm;
             gettimeofday(&tm, NULL);
-            systime = (u32) tm.tv_sec*1000000 + tm.tv_usec; // microsecs 
+            systime = (u64) tm.tv_sec*1000000 + tm.tv_usec; // microsecs 
 
             return systime;
         }
@@ -2784,6 +2787,11 @@ const char *getBuild() { // courtesy of S.O.
 
             return systime;
         }
+        u64 ReadMonotonicTimerMySec() {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return (u64) ts.tv_sec*1000000 + ts.tv_nsec / 1000;
+        }
         u64 ReadCPUTimer() {
             u64 ticks = 0;
             #ifndef __arm__
@@ -2801,6 +2809,12 @@ const char *getBuild() { // courtesy of S.O.
         void XSleep(u32 ms) {
             usleep(1000 * ms);
         }
+        void XSleepMySec(u64 mys) {
+            struct timespec ts;
+            ts.tv_sec = mys / 1000000;
+            ts.tv_nsec = (mys % 1000000) * 1000;
+            nanosleep(&ts, NULL);
+        }
 
         u8 *LoadFileMMAP(char *filepath, u64 *size_bytes) {
             FILE *f = fopen(filepath, "rb");
@@ -2949,7 +2963,7 @@ const char *getBuild() { // courtesy of S.O.
 
             long tv_sec  = (long) ((time - EPOCH) / 10000000L);
             long tv_usec = (long) (system_time.wMilliseconds * 1000);
-            u64 systime = (u32) tv_sec*1000000 + tv_usec; // microsecs 
+            u64 systime = (u64) tv_sec*1000000 + tv_usec; // microsecs 
             return systime;
         }
         u32 ReadSystemTimerMySec32() {
@@ -2970,6 +2984,17 @@ const char *getBuild() { // courtesy of S.O.
 
             return systime;
         }
+        u64 ReadMonotonicTimerMySec() {
+            static LARGE_INTEGER freq;
+            if (freq.QuadPart == 0) {
+                QueryPerformanceFrequency(&freq);
+            }
+            LARGE_INTEGER ticks;
+            QueryPerformanceCounter(&ticks);
+            u64 secs = ticks.QuadPart / freq.QuadPart;
+            u64 rest = ticks.QuadPart % freq.QuadPart;
+            return secs*1000000 + rest*1000000 / freq.QuadPart;
+        }
         u64 ReadCPUTimer() {
             u64 rd = __rdtsc();
             return rd;
@@ -2981,6 +3006,22 @@ const char *getBuild() { // courtesy of S.O.
         void XSleep(u32 ms) {
             Sleep(ms);
         }
+        #ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+        #define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+        #endif
+        void XSleepMySec(u64 mys) {
+            // a high resolution timer wakes up within a fraction of a ms (Windows 10 1803 on),
+            // Sleep only at the scheduler tick, see timeBeginPeriod
+            static thread_local HANDLE timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+            if (timer == NULL) {
+                Sleep((DWORD) (mys / 1000));
+                return;
+            }
+            LARGE_INTEGER due;
+            due.QuadPart = -(LONGLONG) (mys * 10); // relative, in 100 ns
+            SetWaitableTimer(timer, &due, 0, NULL, NULL, FALSE);
+            WaitForSingleObject(timer, INFINITE);
+        }
 
 
         u8 *LoadFileMMAP(char *filepath, u64 *size_bytes) {
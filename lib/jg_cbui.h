@@ -1677,9 +1677,9 @@ struct QuadHexaVertex { // renderable six-vertex quad
     inline
     f32 GetHeight() {
         f32 y0 = verts[0].pos.y;
-        s32 y1 = verts[2].pos.y;
-        s32 width = y1 - y0;
-        return width;
+        f32 y1 = verts[2].pos.y;
+        f32 height = y1 - y0;
+        return height;
     }
     inline
     f32 GetX0() {
@@ -1748,26 +1748,58 @@ struct QuadHexaVertex { // renderable six-vertex quad
     }
 };
 
-QuadHexaVertex QuadCookSolid(f32 w, f32 h, f32 x0, f32 y0, Color c) {
-    // lays down two three-vertex triangles: T1 = [ urc->lrc->llc ] and T2 = [ llc->ulc->urc ]
-    // ulc: upper-left corner (etc.)
-    QuadHexaVertex qh = {};
-    f32 x1 = x0 + w;
-    f32 y1 = y0 + h;
 
-    Vector2f ulc_pos { x0, y0 };
-    Vector2f urc_pos { x1, y0 };
-    Vector2f lrc_pos { x1, y1 };
-    Vector2f llc_pos { x0, y1 };
+//
+//  Quad
+//
+//  What the quad buffer and the rasterizer work on: the pixel rect, rounded once
+//  when the quad is made, the texture rect, the color and a texture index, in 32
+//  bytes. QuadHexaVertex is the six-vertex form, kept for the cooked glyphs of the
+//  font format and for GPU paths that need vertices, see QuadExpand().
+
+
+struct Quad {
+    s16 x0;         // pixel rect
+    s16 y0;
+    s16 w;
+    s16 h;
+    f32 u0;         // texture rect, normalized
+    f32 v0;
+    f32 u1;
+    f32 v1;
+    Color color;    // zero for 32bit textures, a glyph or solid quad otherwise
+    u16 texture;    // texture index, 0 for solid quads
+    u16 pad;
+};
+static_assert(sizeof(Quad) == 32, "Quad should stay compact");
 
-    qh.verts[0] = InitQuadVertex( urc_pos, { 0, 0 }, c, 0 );
-    qh.verts[1] = InitQuadVertex( lrc_pos, { 0, 0 }, c, 0 );
-    qh.verts[2] = InitQuadVertex( llc_pos, { 0, 0 }, c, 0 );
-    qh.verts[3] = InitQuadVertex( llc_pos, { 0, 0 }, c, 0 );
-    qh.verts[4] = InitQuadVertex( ulc_pos, { 0, 0 }, c, 0 );
-    qh.verts[5] = InitQuadVertex( urc_pos, { 0, 0 }, c, 0 );
+inline
+s16 QuadCoord(f32 v) {
+    // rounded and saturated, far off-screen quads stay off-screen
+    f32 r = round(v);
+    return (s16) MaxF32(-32768.0f, MinF32(32767.0f, r));
+}
 
-    return qh;
+inline
+Quad InitQuad(f32 x0, f32 y0, f32 x1, f32 y1, Color color, u16 texture = 0, f32 u0 = 0, f32 v0 = 0, f32 u1 = 0, f32 v1 = 0) {
+    Quad q = {};
+    q.x0 = QuadCoord(x0);
+    q.y0 = QuadCoord(y0);
+    q.w = QuadCoord(x1 - x0);
+    q.h = QuadCoord(y1 - y0);
+    q.u0 = u0;
+    q.v0 = v0;
+    q.u1 = u1;
+    q.v1 = v1;
+    q.color = color;
+    q.texture = texture;
+    return q;
+}
+
+Quad QuadCookSolid(f32 w, f32 h, f32 x0, f32 y0, Color c) {
+    f32 x1 = x0 + w;
+    f32 y1 = y0 + h;
+    return InitQuad(x0, y0, x1, y1, c);
 }
 
 QuadHexaVertex QuadCookTextured(Sprite s, s32 x0, s32 y0, u64 texture_id) {
@@ -1801,17 +1833,13 @@ QuadHexaVertex QuadCookTextured(Sprite s, s32 x0, s32 y0, u64 texture_id) {
 }
 
 inline
-QuadHexaVertex QuadOffset(QuadHexaVertex *q, s16 x, s16 y, Color color, u64 texture_id) {
-    QuadHexaVertex out = {};
-    for (u32 i = 0; i < 6; ++i) {
-        QuadVertex v = *(q->verts + i);
-        v.pos.x += x;
-        v.pos.y += y;
-        v.col = color;
-        v.tex_id = texture_id;
-        out.verts[i] = v;
-    }
-    return out;
+Quad QuadOffset(QuadHexaVertex *q, s16 x, s16 y, Color color, u16 texture) {
+    // a cooked glyph, moved to (x, y)
+    f32 x0 = q->GetX0() + x;
+    f32 y0 = q->GetY0() + y;
+    f32 x1 = q->verts[0].pos.x + x;
+    f32 y1 = q->verts[2].pos.y + y;
+    return InitQuad(x0, y0, x1, y1, color, texture, q->GetTextureU0(), q->GetTextureV0(), q->GetTextureU1(), q->GetTextureV1());
 }
 
 
@@ -1840,7 +1868,8 @@ Color SampleTextureRGBASafe(ImageRGBA *tex, f32 x, f32 y, Color col_default) {
     return b;
 }
 
-void BlitSprite(Sprite s, s32 x0, s32 y0, ImageRGBA *img_dest, ImageRGBA *img_src) {
+void BlitSprite(Sprite s, s32 x0, s32 y0, ImageRGBA *img_dest, ImageRGBA *img_src, Rect clip) {
+    // only pixels inside clip are written, clip must lie inside img_dest
     s32 q_w = s.w;
     s32 q_h = s.h;
     s32 q_x0 = x0;
@@ -1859,17 +1888,16 @@ void BlitSprite(Sprite s, s32 x0, s32 y0, ImageRGBA *img_dest, ImageRGBA *img_sr
     // i,j          : target coords
     // i_img, j_img : img coords
 
-    for (s32 j = 0; j < q_h; ++j) {
+    s32 i0 = MaxS32(0, clip.left - q_x0);
+    s32 i1 = MinS32(q_w, clip.left + clip.width - q_x0);
+    s32 j0 = MaxS32(0, clip.top - q_y0);
+    s32 j1 = MinS32(q_h, clip.top + clip.height - q_y0);
+
+    for (s32 j = j0; j < j1; ++j) {
         s32 j_img = j + q_y0;
-        if (j_img < 0 || j_img > img_dest->height) {
-            continue;
-        }
 
-        for (s32 i = 0; i < q_w; ++i) {
+        for (s32 i = i0; i < i1; ++i) {
             s32 i_img = q_x0 + i;
-            if (i_img < 0 || i_img > img_dest->width) {
-                continue;
-            }
             f32 x = q_u0 + i * q_scale_x;
             f32 y = q_v0 + j * q_scale_y;
 
@@ -1894,6 +1922,10 @@ void BlitSprite(Sprite s, s32 x0, s32 y0, ImageRGBA *img_dest, ImageRGBA *img_sr
     }
 }
 
+void BlitSprite(Sprite s, s32 x0, s32 y0, ImageRGBA *img_dest, ImageRGBA *img_src) {
+    BlitSprite(s, x0, y0, img_dest, img_src, InitRectangle(img_dest->width, img_dest->height));
+}
+
 
 struct SpriteMap {
     u32 size_tot;
@@ -2010,10 +2042,60 @@ struct DrawCall {
 };
 
 
-static HashMap g_texture_map;
+//
+//  Textures
+//
+//  Quads refer to their texture by a small index, handed out when the texture is
+//  registered at load time. Index 0 is no texture.
+
+
+#define TEXTURES_MAX 256
+
+struct TextureSlot {
+    u64 key;
+    void *texture;
+};
+
+static TextureSlot g_textures[TEXTURES_MAX];
+static u32 g_textures_cnt = 1;
+static HashMap g_texture_map; // key -> index
+
+u16 TextureRegister(u64 key, void *texture) {
+    u16 idx = (u16) MapGet(&g_texture_map, key);
+    if (idx == 0) {
+        assert(g_textures_cnt < TEXTURES_MAX && "texture registry full");
+        idx = (u16) g_textures_cnt++;
+        MapPut(&g_texture_map, key, (u64) idx);
+    }
+    g_textures[idx] = { key, texture };
+    return idx;
+}
+
+inline
+u16 TextureIndex(u64 key) {
+    return (u16) MapGet(&g_texture_map, key);
+}
+
 void *GetTexture(u64 key) {
-    void *result = (void*) MapGet(&g_texture_map, key);
-    return result;
+    return g_textures[TextureIndex(key)].texture;
+}
+
+QuadHexaVertex QuadExpand(Quad q) {
+    // the six vertices of q, laid out as QuadCookTextured does, for vertex buffers
+    f32 x0 = q.x0;
+    f32 y0 = q.y0;
+    f32 x1 = q.x0 + q.w;
+    f32 y1 = q.y0 + q.h;
+    u64 key = g_textures[q.texture].key;
+
+    QuadHexaVertex qh = {};
+    qh.verts[0] = InitQuadVertex( { x1, y0 }, { q.u1, q.v0 }, q.color, key );
+    qh.verts[1] = InitQuadVertex( { x1, y1 }, { q.u1, q.v1 }, q.color, key );
+    qh.verts[2] = InitQuadVertex( { x0, y1 }, { q.u0, q.v1 }, q.color, key );
+    qh.verts[3] = InitQuadVertex( { x0, y1 }, { q.u0, q.v1 }, q.color, key );
+    qh.verts[4] = InitQuadVertex( { x0, y0 }, { q.u0, q.v0 }, q.color, key );
+    qh.verts[5] = InitQuadVertex( { x1, y0 }, { q.u1, q.v0 }, q.color, key );
+    return qh;
 }
 
 inline
@@ -2025,148 +2107,1042 @@ u8 SampleTexture(ImageB *tex, f32 x, f32 y) {
     return b;
 }
 
-void BlitQuads(Array<QuadHexaVertex> quads, ImageRGBA *img) {
+//
+//  Span fill
+//
+//  Writes one color to a row of pixels. Solid quads and the damage clears spend
+//  most of their time here, so on x64 the rows are filled with SSE2 or, when the
+//  CPU and OS support it, AVX2 stores, chosen once at runtime. Other targets use
+//  the scalar loop.
+
+
+#if defined(__x86_64__) || defined(_M_X64)
+    #define SIMD_X64 1
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #define SIMD_TARGET_AVX2
+    #else
+        #define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+    #endif
+#else
+    #define SIMD_X64 0
+#endif
 
 
-    // TODO: Don't blit a drawcall, just blit the frekkin quads directly:
-    //      We can do the type switch below from raw quad data (as OGL would).
+typedef void (*SpanFillFunc)(Color *dest, s32 len, Color color);
+static SpanFillFunc g_span_fill;
+
+void SpanFill_Scalar(Color *dest, s32 len, Color color) {
+    for (s32 i = 0; i < len; ++i) {
+        dest[i] = color;
+    }
+}
 
+#if SIMD_X64
+void SpanFill_SSE2(Color *dest, s32 len, Color color) {
+    u32 val;
+    memcpy(&val, &color, sizeof(val));
+    __m128i v = _mm_set1_epi32((s32) val);
 
-    // get the texture
+    s32 i = 0;
+    for (; i + 8 <= len; i += 8) {
+        _mm_storeu_si128((__m128i*) (dest + i), v);
+        _mm_storeu_si128((__m128i*) (dest + i + 4), v);
+    }
+    for (; i < len; ++i) {
+        dest[i] = color;
+    }
+}
 
+SIMD_TARGET_AVX2
+void SpanFill_AVX2(Color *dest, s32 len, Color color) {
+    u32 val;
+    memcpy(&val, &color, sizeof(val));
+    __m256i v = _mm256_set1_epi32((s32) val);
 
-    for (u32 i = 0; i < quads.len; ++i) {
-        QuadHexaVertex *q = quads.arr + i;
+    s32 i = 0;
+    for (; i + 16 <= len; i += 16) {
+        _mm256_storeu_si256((__m256i*) (dest + i), v);
+        _mm256_storeu_si256((__m256i*) (dest + i + 8), v);
+    }
+    for (; i < len; ++i) {
+        dest[i] = color;
+    }
+}
+
+bool CpuHasAVX2() {
+    #ifdef _MSC_VER
+        // AVX2 in cpuid leaf 7, and the OS has to save the ymm registers (OSXSAVE + XCR0)
+        s32 regs[4];
+        __cpuid(regs, 1);
+        bool osxsave = (regs[2] & (1 << 27)) != 0;
+        bool avx = (regs[2] & (1 << 28)) != 0;
+        if (osxsave == false || avx == false || (_xgetbv(0) & 6) != 6) {
+            return false;
+        }
+        __cpuidex(regs, 7, 0);
+        return (regs[1] & (1 << 5)) != 0;
+    #else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    #endif
+}
+#endif
+
+void SpanFillInit() {
+    #if SIMD_X64
+        g_span_fill = CpuHasAVX2() ? SpanFill_AVX2 : SpanFill_SSE2;
+    #else
+        g_span_fill = SpanFill_Scalar;
+    #endif
+}
+
+inline
+void SpanFill(Color *dest, s32 len, Color color) {
+    if (g_span_fill == NULL) {
+        SpanFillInit();
+    }
+    g_span_fill(dest, len, color);
+}
+
+
+//
+//  Glyph blit
+//
+//  Blends a color onto a row of pixels, weighted by a row of the font atlas. The
+//  atlas column of every pixel is looked up once per quad rather than per pixel,
+//  and the blend is integer, with floor(x / 255) done as (x + 1 + (x >> 8)) >> 8,
+//  which is exact for x <= 65534. Results are within 1 of the float blend. The SSE2
+//  path does four pixels a go.
+
+
+inline
+u32 Div255(u32 x) {
+    return (x + 1 + (x >> 8)) >> 8;
+}
+
+inline
+void BlendGlyphPixel(Color *dest, u8 alpha, Color color) {
+    if (alpha == 0) {
+        return;
+    }
+    u32 alpha_inv = 255 - alpha;
+    Color bg = *dest;
+    dest->r = (u8) (Div255(alpha * color.r) + Div255(alpha_inv * bg.r));
+    dest->g = (u8) (Div255(alpha * color.g) + Div255(alpha_inv * bg.g));
+    dest->b = (u8) (Div255(alpha * color.b) + Div255(alpha_inv * bg.b));
+    dest->a = 255;
+}
 
-        s32 q_w = round( q->GetWidth() );
-        s32 q_h = round( q->GetHeight() );
-        s32 q_x0 = round( q->GetX0() );
-        s32 q_y0 = round( q->GetY0() );
-        u64 q_texture = q->GetTextureId();
-        Color q_color = q->GetColor();
+#if SIMD_X64
+inline
+__m128i Div255_SSE2(__m128i x) {
+    __m128i one = _mm_set1_epi16(1);
+    return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(x, one), _mm_srli_epi16(x, 8)), 8);
+}
+
+inline
+__m128i BlendGlyph2_SSE2(__m128i bg, __m128i alpha, __m128i color) {
+    // two pixels in 16 bit lanes, alpha broadcast to each pixel's four lanes
+    __m128i alpha_inv = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+    __m128i fg_part = Div255_SSE2(_mm_mullo_epi16(alpha, color));
+    __m128i bg_part = Div255_SSE2(_mm_mullo_epi16(alpha_inv, bg));
+    return _mm_add_epi16(fg_part, bg_part);
+}
+#endif
+
+#define GLYPH_COLS_CHUNK 256
+
+void BlitGlyphRow(Color *dest, s32 len, u8 *tex_row, u16 *cols, Color color) {
+    // cols: atlas column of every pixel
+    s32 i = 0;
 
-        // MOD
-        if (img->height < q_h || img->width < q_w) {
+    #if SIMD_X64
+    __m128i zero = _mm_setzero_si128();
+    __m128i color16 = _mm_set_epi16(color.a, color.b, color.g, color.r, color.a, color.b, color.g, color.r);
+    __m128i opaque = _mm_set1_epi32((s32) 0xff000000);
+
+    for (; i + 4 <= len; i += 4) {
+        u8 a0 = tex_row[cols[i]];
+        u8 a1 = tex_row[cols[i + 1]];
+        u8 a2 = tex_row[cols[i + 2]];
+        u8 a3 = tex_row[cols[i + 3]];
+        if ((a0 | a1 | a2 | a3) == 0) {
             continue;
         }
 
-        u32 stride_img = img->width;
+        __m128i bg = _mm_loadu_si128((__m128i*) (dest + i));
+        __m128i alpha_lo = _mm_set_epi16(a1, a1, a1, a1, a0, a0, a0, a0);
+        __m128i alpha_hi = _mm_set_epi16(a3, a3, a3, a3, a2, a2, a2, a2);
+        __m128i lo = BlendGlyph2_SSE2(_mm_unpacklo_epi8(bg, zero), alpha_lo, color16);
+        __m128i hi = BlendGlyph2_SSE2(_mm_unpackhi_epi8(bg, zero), alpha_hi, color16);
+        __m128i out = _mm_or_si128(_mm_packus_epi16(lo, hi), opaque);
+
+        // pixels with zero alpha are left as they were
+        __m128i keep = _mm_cmpeq_epi32(_mm_set_epi32(a3, a2, a1, a0), zero);
+        out = _mm_or_si128(_mm_and_si128(keep, bg), _mm_andnot_si128(keep, out));
+        _mm_storeu_si128((__m128i*) (dest + i), out);
+    }
+    #endif
+
+    for (; i < len; ++i) {
+        BlendGlyphPixel(dest + i, tex_row[cols[i]], color);
+    }
+}
+
 
-        void *texture = GetTexture(q_texture);
-        ImageB *texture_b = (ImageB*) texture;
-        ImageRGBA *texture_rgba = (ImageRGBA*) texture;
+void BlitQuad(Quad *q, ImageRGBA *img, Rect clip) {
+    // only pixels inside clip are written, clip must lie inside img
 
+    s32 q_w = q->w;
+    s32 q_h = q->h;
+    s32 q_x0 = q->x0;
+    s32 q_y0 = q->y0;
+    u16 q_texture = q->texture;
+    Color q_color = q->color;
 
-        //
-        // byte-texture / glyphs
-        //
-        if (q_texture != 0 && q_color.IsNonZero()) {
-            assert(texture_b != NULL);
+    // MOD
+    if (img->height < q_h || img->width < q_w) {
+        return;
+    }
+
+    // the part of the quad inside clip, in quad coords
+    s32 i0 = MaxS32(0, clip.left - q_x0);
+    s32 i1 = MinS32(q_w, clip.left + clip.width - q_x0);
+    s32 j0 = MaxS32(0, clip.top - q_y0);
+    s32 j1 = MinS32(q_h, clip.top + clip.height - q_y0);
+    if (i0 >= i1 || j0 >= j1) {
+        return;
+    }
 
-            f32 q_scale_x = q->GetTextureScaleX(q_w);
-            f32 q_scale_y = q->GetTextureScaleY(q_h);
-            f32 q_u0 = q->GetTextureU0();
-            f32 q_v0 = q->GetTextureV0();
+    u32 stride_img = img->width;
 
-            // i,j          : target coords
-            // i_img, j_img : img coords
+    void *texture = g_textures[q_texture].texture;
+    ImageB *texture_b = (ImageB*) texture;
+    ImageRGBA *texture_rgba = (ImageRGBA*) texture;
 
-            for (s32 j = 0; j < q_h; ++j) {
+
+    //
+    // byte-texture / glyphs
+    //
+    if (q_texture != 0 && q_color.IsNonZero()) {
+        assert(texture_b != NULL);
+
+        f32 q_scale_x = (q->u1 - q->u0) / q_w;
+        f32 q_scale_y = (q->v1 - q->v0) / q_h;
+        f32 q_u0 = q->u0;
+        f32 q_v0 = q->v0;
+
+        // i,j          : target coords
+        // i_img, j_img : img coords
+
+        // the atlas columns, rounded as SampleTexture does
+        u16 cols[GLYPH_COLS_CHUNK];
+        for (s32 i_chunk = i0; i_chunk < i1; i_chunk += GLYPH_COLS_CHUNK) {
+            s32 len = MinS32(GLYPH_COLS_CHUNK, i1 - i_chunk);
+            for (s32 i = 0; i < len; ++i) {
+                f32 x = q_u0 + (i_chunk + i) * q_scale_x;
+                cols[i] = (u16) round(texture_b->width * x);
+            }
+
+            for (s32 j = j0; j < j1; ++j) {
                 s32 j_img = j + q_y0;
-                if (j_img < 0 || j_img > img->height) {
-                    continue;
-                }
+                f32 y = q_v0 + j * q_scale_y;
+                u32 j_tex = (s32) round(texture_b->height * y);
 
-                for (s32 i = 0; i < q_w; ++i) {
-                    s32 i_img = q_x0 + i;
-                    if (i_img < 0 || i_img > img->width) {
-                        continue;
-                    }
-                    f32 x = q_u0 + i * q_scale_x;
-                    f32 y = q_v0 + j * q_scale_y;
-                    if (u8 alpha_byte = SampleTexture(texture_b, x, y)) {
-                        // rudimentary alpha-blending
-                        u32 idx = (u32) (j_img * stride_img + i_img);
-                        Color color_background = img->img[idx];
-
-                        f32 alpha = (1.0f * alpha_byte) / 255;
-                        Color color_blended;
-                        color_blended.r = (u8) (floor( alpha*q_color.r ) + floor( (1-alpha)*color_background.r ));
-                        color_blended.g = (u8) (floor( alpha*q_color.g ) + floor( (1-alpha)*color_background.g ));
-                        color_blended.b = (u8) (floor( alpha*q_color.b ) + floor( (1-alpha)*color_background.b ));
-                        color_blended.a = 255;
-
-                        img->img[idx] = color_blended;
-                    }
-                }
+                Color *row = img->img + j_img * stride_img + q_x0 + i_chunk;
+                BlitGlyphRow(row, len, texture_b->img + j_tex * texture_b->width, cols, q_color);
             }
         }
+    }
+
+    //
+    // mono-color quads
+    //
+    else if (q_texture == 0 && q_color.IsNonZero()) {
+        for (s32 j = j0; j < j1; ++j) {
+            Color *row = img->img + (j + q_y0) * stride_img + q_x0;
+            SpanFill(row + i0, i1 - i0, q_color);
+        }
+    }
+
+    //
+    // blit 32bit texture
+    //
+    else if (q_texture != 0 && q_color.IsZero()) {
+        assert(texture_rgba != NULL);
+
+        // TODO: integrate
+        Sprite s = {};
+        s.w = q_w;
+        s.h = q_h;
+        s.u0 = q->u0;
+        s.u1 = q->u1;
+        s.v0 = q->v0;
+        s.v1 = q->v1;
+        BlitSprite(s, q_x0, q_y0, img, texture_rgba, clip);
+    }
+}
+
+void BlitQuads(Array<Quad> quads, ImageRGBA *img, Rect clip) {
+    // TODO: Don't blit a drawcall, just blit the frekkin quads directly:
+    //      We can do the type switch below from raw quad data (as OGL would).
+
+    for (u32 i = 0; i < quads.len; ++i) {
+        BlitQuad(quads.arr + i, img, clip);
+    }
+}
+
+void BlitQuads(Array<Quad> quads, ImageRGBA *img) {
+    BlitQuads(quads, img, InitRectangle(img->width, img->height));
+}
+
+
+//
+//  Damage tracking
+//
+//  The image buffer is kept between frames. Each frame the quads are hashed into
+//  screen tiles, in draw order, and only the tiles whose hash changed since the last
+//  frame are cleared, re-blitted and uploaded. Widgets, text and anything else that
+//  ends up in the quad buffer are covered without having to report what they changed.
+//  Each quad is binned into the dirty tiles it touches, so a tile is redrawn from its
+//  own quad list. For the upload, dirty tiles are merged into rects: runs of tiles
+//  within a tile row, and runs with the same extent in consecutive rows.
+//
+//  Writing into the frame other than through the quad buffer is not tracked per tile.
+//  A frame rasterized for direct drawing is redrawn in full, so all of it is uploaded,
+//  and so is the next one, which erases what was drawn. DamageInvalidate() forces a
+//  full redraw, e.g. after a resize.
+
+
+#define DAMAGE_TILE_SZ 64
+#define DAMAGE_TILES_X_MAX 64 // 4096 px
+#define DAMAGE_TILES_Y_MAX 64
+#define DAMAGE_TILES_MAX (DAMAGE_TILES_X_MAX * DAMAGE_TILES_Y_MAX)
+#define DAMAGE_RECTS_MAX (DAMAGE_TILES_MAX / 2)
+#define DAMAGE_OCCLUDERS_MAX 256 // solid quads per tile tested for hiding others, later ones just aren't
+
+struct DamageTracker {
+    s32 width;
+    s32 height;
+    s32 tiles_x;
+    s32 tiles_y;
+    bool invalid;   // redraw everything next frame
+    bool show;      // debug overlay, outlines the damaged tiles
+
+    u32 cur;        // hashes[cur] is this frame
+    u64 hashes[2][DAMAGE_TILES_Y_MAX][DAMAGE_TILES_X_MAX];
+    u8 damaged[DAMAGE_TILES_Y_MAX][DAMAGE_TILES_X_MAX];
+    bool direct;    // this frame is drawn into directly after the quads, see CbuiFrameRasterize
+    u8 outlined[DAMAGE_TILES_Y_MAX][DAMAGE_TILES_X_MAX]; // overlay pixels to be erased next frame
+    u8 dirty[DAMAGE_TILES_Y_MAX][DAMAGE_TILES_X_MAX];    // redrawn this frame
+
+    // the quads of each dirty tile, as indices in submission order
+    u16 dirty_tiles[DAMAGE_TILES_MAX]; // ty * DAMAGE_TILES_X_MAX + tx
+    u32 dirty_cnt;
+    u32 bin_first[DAMAGE_TILES_MAX + 1];
+    u32 bin_cursor[DAMAGE_TILES_Y_MAX][DAMAGE_TILES_X_MAX];
+    u32 *bins;
+
+    Rect rects[DAMAGE_RECTS_MAX];
+    u32 rects_cnt;
+
+    // pixels stored and pixels skipped under solid quads, per dirty tile
+    u32 tile_written[DAMAGE_TILES_MAX];
+    u32 tile_occluded[DAMAGE_TILES_MAX];
+
+    // last frame stats
+    u32 tiles_damaged;
+    u64 pixels_redrawn;
+    u64 pixels_written;     // by clears and blits, pixels_written / pixels_redrawn is the overdraw
+    u64 pixels_occluded;    // of quads skipped because a later solid quad covers them
+};
+
+struct DamageFootprint {
+    s16 tx0;
+    s16 ty0;
+    s16 tx1; // inclusive, tx1 < tx0 for quads that don't touch the screen
+    s16 ty1;
+};
 
-        //
-        // mono-color quads
-        //
-        else if (q_texture == 0 && q_color.IsNonZero()) {
-            s32 j_img;
-            s32 i_img;
-            u32 idx;
-            for (s32 j = 0; j < q_h; ++j) {
-                j_img = j + q_y0;
-                if (j_img < 0 || j_img > img->height) {
-                    continue;
+static DamageTracker g_damage;
+
+void DamageInvalidate() {
+    g_damage.invalid = true;
+}
+
+inline
+u64 DamageMix(u64 h, u64 v) {
+    // splitmix64 finalizer over h ^ v
+    u64 x = h ^ v;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+u64 DamageQuadHash(Quad *q) {
+    // everything the blitted pixels depend on: the pixel rect, color, texture and uvs
+    u64 words[4];
+    memcpy(words, q, sizeof(words));
+    u64 h = DamageMix(0, words[0]);
+    h = DamageMix(h, ((u64) q->color.GetAsU32() << 32) | q->texture);
+    if (q->texture != 0) {
+        h = DamageMix(h, words[1]);
+        h = DamageMix(h, words[2]);
+    }
+    return h;
+}
+
+DamageFootprint QuadFootprint(Quad *q, s32 width, s32 height) {
+    // the tiles q touches, same pixel footprint as BlitQuad
+    DamageFootprint fp = { 0, 0, -1, -1 };
+    if (height < q->h || width < q->w) {
+        return fp;
+    }
+    s32 x0 = MaxS32(0, q->x0);
+    s32 y0 = MaxS32(0, q->y0);
+    s32 x1 = MinS32(width, q->x0 + q->w);
+    s32 y1 = MinS32(height, q->y0 + q->h);
+    if (x0 >= x1 || y0 >= y1) {
+        return fp;
+    }
+    fp = { (s16) (x0 / DAMAGE_TILE_SZ), (s16) (y0 / DAMAGE_TILE_SZ), (s16) ((x1 - 1) / DAMAGE_TILE_SZ), (s16) ((y1 - 1) / DAMAGE_TILE_SZ) };
+    return fp;
+}
+
+Rect DamageTileRect(DamageTracker *dmg, s32 tx, s32 ty) {
+    s32 left = tx * DAMAGE_TILE_SZ;
+    s32 top = ty * DAMAGE_TILE_SZ;
+    s32 w = MinS32(DAMAGE_TILE_SZ, dmg->width - left);
+    s32 h = MinS32(DAMAGE_TILE_SZ, dmg->height - top);
+    return InitRectangle(w, h, left, top);
+}
+
+void DamageRectsBuild(DamageTracker *dmg) {
+    dmg->rects_cnt = 0;
+    u32 rects_prev_row = 0; // rects ending at the previous tile row start here
+
+    for (s32 ty = 0; ty < dmg->tiles_y; ++ty) {
+        u32 rects_this_row = dmg->rects_cnt;
+        s32 top = ty * DAMAGE_TILE_SZ;
+        s32 height = MinS32(DAMAGE_TILE_SZ, dmg->height - top);
+
+        for (s32 tx = 0; tx < dmg->tiles_x; ++tx) {
+            if (dmg->dirty[ty][tx] == 0) {
+                continue;
+            }
+            s32 tx_end = tx;
+            while (tx_end < dmg->tiles_x && dmg->dirty[ty][tx_end]) {
+                tx_end++;
+            }
+            s32 left = tx * DAMAGE_TILE_SZ;
+            s32 width = MinS32(tx_end * DAMAGE_TILE_SZ, dmg->width) - left;
+            tx = tx_end;
+
+            // extend a rect from the row above with the same extent
+            bool extended = false;
+            for (u32 i = rects_prev_row; i < rects_this_row; ++i) {
+                Rect *r = dmg->rects + i;
+                if (r->left == left && r->width == width && r->top + r->height == top) {
+                    r->height += height;
+                    extended = true;
+                    break;
                 }
+            }
+            if (extended == false) {
+                assert(dmg->rects_cnt < DAMAGE_RECTS_MAX);
+                dmg->rects[dmg->rects_cnt++] = InitRectangle(width, height, left, top);
+            }
+        }
+        rects_prev_row = rects_this_row;
+    }
+}
 
-                for (s32 i = 0; i < q_w; ++i) {
-                    i_img = q_x0 + i;
-                    if (i_img < 0 || i_img > img->width) {
-                        continue;
-                    }
+void DamageUpdate(MArena *a_tmp, Array<Quad> quads, s32 width, s32 height) {
+    // hashes this frame's quads, finds the tiles to redraw and bins the quads into them
+    DamageTracker *dmg = &g_damage;
+    if (width != dmg->width || height != dmg->height) {
+        dmg->width = width;
+        dmg->height = height;
+        dmg->tiles_x = (width + DAMAGE_TILE_SZ - 1) / DAMAGE_TILE_SZ;
+        dmg->tiles_y = (height + DAMAGE_TILE_SZ - 1) / DAMAGE_TILE_SZ;
+        assert(dmg->tiles_x <= DAMAGE_TILES_X_MAX && dmg->tiles_y <= DAMAGE_TILES_Y_MAX);
+        dmg->invalid = true;
+    }
+
+    dmg->cur ^= 1;
+    u64 (*hash)[DAMAGE_TILES_X_MAX] = dmg->hashes[dmg->cur];
+    u64 (*hash_prev)[DAMAGE_TILES_X_MAX] = dmg->hashes[dmg->cur ^ 1];
+    memset(hash, 0, sizeof(dmg->hashes[0]));
+    memset(dmg->bin_cursor, 0, sizeof(dmg->bin_cursor));
+
+    DamageFootprint *footprints = (DamageFootprint*) ArenaAlloc(a_tmp, sizeof(DamageFootprint) * quads.len, false);
+    for (u32 i = 0; i < quads.len; ++i) {
+        Quad *q = quads.arr + i;
+        DamageFootprint *fp = footprints + i;
+        *fp = QuadFootprint(q, width, height);
+        if (fp->tx1 < fp->tx0) {
+            continue;
+        }
 
-                    idx = j_img * stride_img + i_img;
-                    img->img[idx] = q_color;
+        u64 h = DamageQuadHash(q);
+        for (s32 ty = fp->ty0; ty <= fp->ty1; ++ty) {
+            for (s32 tx = fp->tx0; tx <= fp->tx1; ++tx) {
+                hash[ty][tx] = DamageMix(hash[ty][tx], h);
+                dmg->bin_cursor[ty][tx]++;
+            }
+        }
+    }
+
+    // redraw the damaged tiles, and wherever the overlay drew last frame
+    dmg->tiles_damaged = 0;
+    dmg->dirty_cnt = 0;
+    dmg->pixels_redrawn = 0;
+    u32 bins_len = 0;
+    for (s32 ty = 0; ty < dmg->tiles_y; ++ty) {
+        for (s32 tx = 0; tx < dmg->tiles_x; ++tx) {
+            u8 damaged = dmg->invalid || hash[ty][tx] != hash_prev[ty][tx];
+            u8 dirty = damaged || dmg->outlined[ty][tx];
+            dmg->damaged[ty][tx] = damaged;
+            dmg->dirty[ty][tx] = dirty;
+            dmg->tiles_damaged += damaged;
+
+            if (dirty) {
+                Rect r = DamageTileRect(dmg, tx, ty);
+                dmg->pixels_redrawn += (u64) r.width * r.height;
+
+                // from here on bin_cursor is where the tile's next quad index goes
+                u32 cnt = dmg->bin_cursor[ty][tx];
+                dmg->bin_first[dmg->dirty_cnt] = bins_len;
+                dmg->dirty_tiles[dmg->dirty_cnt++] = (u16) (ty * DAMAGE_TILES_X_MAX + tx);
+                dmg->bin_cursor[ty][tx] = bins_len;
+                bins_len += cnt;
+            }
+        }
+    }
+    dmg->bin_first[dmg->dirty_cnt] = bins_len;
+    memset(dmg->outlined, 0, sizeof(dmg->outlined));
+    dmg->invalid = false;
+
+    dmg->bins = (u32*) ArenaAlloc(a_tmp, sizeof(u32) * bins_len, false);
+    for (u32 i = 0; i < quads.len; ++i) {
+        DamageFootprint fp = footprints[i];
+        for (s32 ty = fp.ty0; ty <= fp.ty1; ++ty) {
+            for (s32 tx = fp.tx0; tx <= fp.tx1; ++tx) {
+                if (dmg->dirty[ty][tx]) {
+                    dmg->bins[dmg->bin_cursor[ty][tx]++] = i;
                 }
             }
         }
+    }
+
+    DamageRectsBuild(dmg);
+}
+
+void ImageFillRect(ImageRGBA *img, Rect r, Color color) {
+    for (s32 j = r.top; j < r.top + r.height; ++j) {
+        SpanFill(img->img + j * img->width + r.left, r.width, color);
+    }
+}
 
-        //
-        // blit 32bit texture
-        //
-        else if (q_texture != 0 && q_color.IsZero()) {
-            assert(texture_rgba != NULL);
+void DamageOverlayDraw(ImageRGBA *img) {
+    // outlines every damaged tile, the pixels are erased by next frame's redraw
+    DamageTracker *dmg = &g_damage;
+    Color col = COLOR_RED;
 
-            // TODO: integrate
-            Sprite s = {};
-            s.w = q_w;
-            s.h = q_h;
-            s.u0 = q->GetTextureU0();
-            s.u1 = q->GetTextureU1();
-            s.v0 = q->GetTextureV0();
-            s.v1 = q->GetTextureV1();
-            BlitSprite(s, q_x0, q_y0, img, texture_rgba);
+    for (s32 ty = 0; ty < dmg->tiles_y; ++ty) {
+        for (s32 tx = 0; tx < dmg->tiles_x; ++tx) {
+            if (dmg->damaged[ty][tx] == 0) {
+                continue;
+            }
+            Rect r = DamageTileRect(dmg, tx, ty);
+
+            ImageFillRect(img, InitRectangle(r.width, 1, r.left, r.top), col);
+            ImageFillRect(img, InitRectangle(r.width, 1, r.left, r.top + r.height - 1), col);
+            ImageFillRect(img, InitRectangle(1, r.height, r.left, r.top), col);
+            ImageFillRect(img, InitRectangle(1, r.height, r.left + r.width - 1, r.top), col);
+            dmg->outlined[ty][tx] = 1;
         }
     }
 }
 
+inline
+bool QuadIsOpaque(Quad *q) {
+    // solid quads overwrite their pixels, glyphs and 32bit textures blend
+    return q->texture == 0 && q->color.IsNonZero();
+}
+
+inline
+bool QuadCovers(Quad *q, Rect r) {
+    return q->x0 <= r.left && q->x0 + q->w >= r.left + r.width && q->y0 <= r.top && q->y0 + q->h >= r.top + r.height;
+}
+
+void DamageRasterTile(Array<Quad> quads, ImageRGBA *img, u32 k) {
+    // clears the k'th dirty tile and blits its quads, except those a later solid quad covers
+    DamageTracker *dmg = &g_damage;
+    u32 tile = dmg->dirty_tiles[k];
+    Rect r = DamageTileRect(dmg, tile % DAMAGE_TILES_X_MAX, tile / DAMAGE_TILES_X_MAX);
+    u32 *bin = dmg->bins;
+    u32 b0 = dmg->bin_first[k];
+    u32 b1 = dmg->bin_first[k + 1];
+    u32 written = 0;
+    u32 occluded = 0;
+
+    // the last solid quad over the whole tile hides the clear and everything before it
+    u32 b_start = b0;
+    bool clear = true;
+    for (u32 b = b1; b > b0; --b) {
+        Quad *q = quads.arr + bin[b - 1];
+        if (QuadIsOpaque(q) && QuadCovers(q, r)) {
+            b_start = b - 1;
+            clear = false;
+            break;
+        }
+    }
+    if (clear) {
+        ImageFillRect(img, r, COLOR_WHITE);
+        written += r.width * r.height;
+    }
+
+    // the solid quads that may hide others, in bin order
+    u32 occluders[DAMAGE_OCCLUDERS_MAX];
+    u32 occluders_cnt = 0;
+    for (u32 b = b_start + 1; b < b1 && occluders_cnt < DAMAGE_OCCLUDERS_MAX; ++b) {
+        if (QuadIsOpaque(quads.arr + bin[b])) {
+            occluders[occluders_cnt++] = b;
+        }
+    }
+
+    u32 o_first = 0;
+    for (u32 b = b_start; b < b1; ++b) {
+        Quad *q = quads.arr + bin[b];
+        s32 x0 = MaxS32(r.left, q->x0);
+        s32 y0 = MaxS32(r.top, q->y0);
+        s32 x1 = MinS32(r.left + r.width, q->x0 + q->w);
+        s32 y1 = MinS32(r.top + r.height, q->y0 + q->h);
+        Rect visible = InitRectangle(x1 - x0, y1 - y0, x0, y0);
+        u32 area = (x1 - x0) * (y1 - y0);
+
+        while (o_first < occluders_cnt && occluders[o_first] <= b) {
+            o_first++;
+        }
+        bool hidden = false;
+        for (u32 o = o_first; o < occluders_cnt; ++o) {
+            if (QuadCovers(quads.arr + bin[occluders[o]], visible)) {
+                hidden = true;
+                break;
+            }
+        }
+        if (hidden) {
+            occluded += area;
+            continue;
+        }
+        BlitQuad(q, img, r);
+        written += area;
+    }
+    dmg->tile_written[k] = written;
+    dmg->tile_occluded[k] = occluded;
+}
+
 
 //
-// sprite render API (hides the drawcall buffer)
+//  Raster workers
+//
+//  Dirty tiles don't share pixels, so they are rasterized on a pool of worker
+//  threads plus the calling thread, pulling tiles off an atomic counter. A tile is
+//  blitted by a single thread in submission order, so the image is identical to a
+//  serial blit whatever the scheduling. Frames with few dirty tiles stay on the
+//  calling thread, waking the workers would cost more than it saves.
+
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#define RASTER_THREADS_MAX 16
+#define RASTER_MT_MIN_TILES 16
+
+struct RasterPool {
+    std::thread *threads;
+    u32 nthreads;       // workers, not counting the calling thread
+    std::mutex mtx;
+    std::condition_variable cv_start;
+    std::condition_variable cv_done;
+    u64 generation;     // bumped for every job
+    u32 busy;           // workers not done with the current job
+    bool quit;
+
+    // the current job
+    Array<Quad> quads;
+    ImageRGBA img;
+    std::atomic<u32> next;
+};
 
+// heap allocated, a static one would block exit in its condition variable
+// destructors if RasterPoolShutdown was never called
+static RasterPool *g_raster_pool;
 
-static Array<QuadHexaVertex> g_quad_buffer;
-void QuadBufferInit(MArena *a_life, u32 max_quads = 2048) {
-    g_quad_buffer = InitArray<QuadHexaVertex>(a_life, max_quads);
+void RasterPoolWork(RasterPool *pool) {
+    u32 k;
+    while ((k = pool->next.fetch_add(1, std::memory_order_relaxed)) < g_damage.dirty_cnt) {
+        DamageRasterTile(pool->quads, &pool->img, k);
+    }
+}
+
+void RasterWorkerRun(RasterPool *pool) {
+    u64 generation = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(pool->mtx);
+            pool->cv_start.wait(lock, [&] { return pool->quit || pool->generation != generation; });
+            if (pool->quit) {
+                return;
+            }
+            generation = pool->generation;
+        }
+
+        RasterPoolWork(pool);
+
+        std::lock_guard<std::mutex> lock(pool->mtx);
+        pool->busy--;
+        if (pool->busy == 0) {
+            pool->cv_done.notify_one();
+        }
+    }
+}
+
+u32 RasterThreadsDefault() {
+    u32 ncores = std::thread::hardware_concurrency();
+    return ncores > 1 ? ncores - 1 : 0;
+}
+
+void RasterPoolInit(u32 nthreads) {
+    // nthreads workers besides the calling thread, with 0 rasterization stays serial
+    assert(g_raster_pool == NULL);
+    SpanFillInit(); // before the workers could race on it
+
+    nthreads = MinU32(nthreads, RASTER_THREADS_MAX);
+    if (nthreads == 0) {
+        return;
+    }
+    RasterPool *pool = new RasterPool();
+    pool->nthreads = nthreads;
+    pool->threads = new std::thread[nthreads];
+    for (u32 i = 0; i < nthreads; ++i) {
+        pool->threads[i] = std::thread(RasterWorkerRun, pool);
+    }
+    g_raster_pool = pool;
+}
+
+void RasterPoolShutdown() {
+    RasterPool *pool = g_raster_pool;
+    if (pool == NULL) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(pool->mtx);
+        pool->quit = true;
+    }
+    pool->cv_start.notify_all();
+    for (u32 i = 0; i < pool->nthreads; ++i) {
+        pool->threads[i].join();
+    }
+    delete[] pool->threads;
+    delete pool;
+    g_raster_pool = NULL;
+}
+
+void DamageRedraw(Array<Quad> quads, ImageRGBA *img) {
+    // clears and re-blits the dirty tiles only
+    DamageTracker *dmg = &g_damage;
+    RasterPool *pool = g_raster_pool;
+
+    if (pool == NULL || dmg->dirty_cnt < RASTER_MT_MIN_TILES) {
+        for (u32 k = 0; k < dmg->dirty_cnt; ++k) {
+            DamageRasterTile(quads, img, k);
+        }
+    }
+    else {
+        {
+            std::lock_guard<std::mutex> lock(pool->mtx);
+            pool->quads = quads;
+            pool->img = *img;
+            pool->next = 0;
+            pool->busy = pool->nthreads;
+            pool->generation++;
+        }
+        pool->cv_start.notify_all();
+
+        RasterPoolWork(pool);
+
+        std::unique_lock<std::mutex> lock(pool->mtx);
+        pool->cv_done.wait(lock, [&] { return pool->busy == 0; });
+    }
+
+    dmg->pixels_written = 0;
+    dmg->pixels_occluded = 0;
+    for (u32 k = 0; k < dmg->dirty_cnt; ++k) {
+        dmg->pixels_written += dmg->tile_written[k];
+        dmg->pixels_occluded += dmg->tile_occluded[k];
+    }
+
+    if (dmg->show) {
+        DamageOverlayDraw(img);
+    }
+}
+
+
+//
+//  Quad buffer
+//
+//  Quads are pushed into a stream of fixed size chunks, allocated from the life
+//  arena as a frame needs them and reused by the frames after it, so there is no
+//  limit on the quad count. Before rasterization the stream is gathered into one
+//  array: quads that can't put a pixel on screen are dropped, and the rest are
+//  bucketed by texture so each glyph atlas is sampled in one go.
+//
+//  Bucketing must not change the image. Every quad gets a level, one above any
+//  earlier quad of another texture sharing a tile with it, and the quads are
+//  stably sorted by (level, texture). Quads that may overlap keep their order,
+//  quads of one texture drawn between unrelated ones are pulled together.
+
+
+#define QUAD_CHUNK_SZ 1024
+#define QUAD_LEVEL_EMPTY 0x10000 // level_tex of a tile without quads
+#define QUAD_LEVEL_MIXED 0x10001 // level_tex of a tile topped by several textures
+
+struct QuadChunk {
+    QuadChunk *next;
+    u32 len;
+    Quad quads[QUAD_CHUNK_SZ];
+};
+
+struct QuadStream {
+    MArena *a_chunks;
+    QuadChunk *first;
+    QuadChunk *cur;
+    u32 len;
+
+    // the texture and top level of each tile, while bucketing
+    u32 level_top[DAMAGE_TILES_Y_MAX][DAMAGE_TILES_X_MAX];
+    u32 level_tex[DAMAGE_TILES_Y_MAX][DAMAGE_TILES_X_MAX];
+
+    // last frame stats
+    u32 pushed;
+    u32 culled;
+    u64 bytes_touched; // quad records written or read by push, bucketing and blit
+};
+
+static QuadStream g_quad_stream;
+
+QuadChunk *QuadChunkAlloc(MArena *a_chunks) {
+    QuadChunk *c = (QuadChunk*) ArenaAlloc(a_chunks, sizeof(QuadChunk), false);
+    c->next = NULL;
+    c->len = 0;
+    return c;
+}
+
+void QuadBufferInit(MArena *a_life) {
+    QuadStream *qs = &g_quad_stream;
+    qs->a_chunks = a_life;
+    qs->first = QuadChunkAlloc(a_life);
+    qs->cur = qs->first;
+    qs->len = 0;
+}
+
+QuadChunk *QuadStreamNextChunk(QuadStream *qs) {
+    if (qs->cur->next == NULL) {
+        qs->cur->next = QuadChunkAlloc(qs->a_chunks);
+    }
+    qs->cur = qs->cur->next;
+    qs->cur->len = 0;
+    return qs->cur;
+}
+
+void QuadStreamClear(QuadStream *qs) {
+    qs->first->len = 0;
+    qs->cur = qs->first;
+    qs->len = 0;
 }
 
 void SpriteRender_PushDrawCall(DrawCall dc) {
     // TODO: do something with this for OGL
 }
 
-void QuadBufferPush(QuadHexaVertex quad) {
-    g_quad_buffer.Add(quad);
+inline
+void QuadBufferPush(Quad quad) {
+    QuadStream *qs = &g_quad_stream;
+    QuadChunk *c = qs->cur;
+    if (c->len == QUAD_CHUNK_SZ) {
+        c = QuadStreamNextChunk(qs);
+    }
+    c->quads[c->len++] = quad;
+    qs->len++;
+}
+
+void QuadBufferPushOffset(Quad *quads, u32 cnt, s32 dx, s32 dy, Color color) {
+    // copies of quads moved by (dx, dy) and recolored, e.g. a cached text run
+    for (u32 i = 0; i < cnt; ++i) {
+        Quad q = quads[i];
+        q.x0 = (s16) MaxS32(-32768, MinS32(32767, q.x0 + dx));
+        q.y0 = (s16) MaxS32(-32768, MinS32(32767, q.y0 + dy));
+        q.color = color;
+        QuadBufferPush(q);
+    }
+}
+
+void QuadBufferPushFramed(Quad outer, Quad inner) {
+    // outer with the solid inner on top, pushed as up to four strips around inner and inner
+    // itself, so no pixel is written twice
+    s32 ox1 = outer.x0 + outer.w;
+    s32 oy1 = outer.y0 + outer.h;
+    s32 ix1 = inner.x0 + inner.w;
+    s32 iy1 = inner.y0 + inner.h;
+    bool nested = inner.w > 0 && inner.h > 0 && inner.x0 >= outer.x0 && inner.y0 >= outer.y0 && ix1 <= ox1 && iy1 <= oy1;
+    if (nested == false || QuadIsOpaque(&outer) == false || QuadIsOpaque(&inner) == false) {
+        QuadBufferPush(outer);
+        QuadBufferPush(inner);
+        return;
+    }
+
+    Quad strip = outer;
+    if (inner.y0 > outer.y0) {
+        strip.h = inner.y0 - outer.y0;
+        QuadBufferPush(strip);
+    }
+    if (oy1 > iy1) {
+        strip.y0 = iy1;
+        strip.h = oy1 - iy1;
+        QuadBufferPush(strip);
+    }
+    strip.y0 = inner.y0;
+    strip.h = inner.h;
+    if (inner.x0 > outer.x0) {
+        strip.w = inner.x0 - outer.x0;
+        QuadBufferPush(strip);
+    }
+    if (ox1 > ix1) {
+        strip.x0 = ix1;
+        strip.w = ox1 - ix1;
+        QuadBufferPush(strip);
+    }
+    QuadBufferPush(inner);
 }
 
-void QuadBufferBlitAndClear(ImageRGBA render_target) {
-    BlitQuads(g_quad_buffer, &render_target);
-    g_quad_buffer.len = 0;
+u32 QuadLevel(QuadStream *qs, DamageFootprint fp, u32 texture) {
+    // places a quad above every earlier quad of another texture in its tiles
+    u32 level = 0;
+    for (s32 ty = fp.ty0; ty <= fp.ty1; ++ty) {
+        for (s32 tx = fp.tx0; tx <= fp.tx1; ++tx) {
+            u32 tex = qs->level_tex[ty][tx];
+            if (tex != QUAD_LEVEL_EMPTY) {
+                u32 top = qs->level_top[ty][tx];
+                level = MaxU32(level, tex == texture ? top : top + 1);
+            }
+        }
+    }
+    for (s32 ty = fp.ty0; ty <= fp.ty1; ++ty) {
+        for (s32 tx = fp.tx0; tx <= fp.tx1; ++tx) {
+            u32 *tex = &qs->level_tex[ty][tx];
+            u32 *top = &qs->level_top[ty][tx];
+            if (*tex == QUAD_LEVEL_EMPTY || level > *top) {
+                *top = level;
+                *tex = texture;
+            }
+            else if (*tex != texture) {
+                *tex = QUAD_LEVEL_MIXED;
+            }
+        }
+    }
+    return level;
+}
+
+Array<Quad> QuadStreamGather(MArena *a_tmp, QuadStream *qs, s32 width, s32 height) {
+    // the visible quads, bucketed by texture without changing what gets drawn
+    Quad **visible = (Quad**) ArenaAlloc(a_tmp, sizeof(Quad*) * qs->len, false);
+    u32 visible_cnt = 0;
+    u32 *levels = (u32*) ArenaAlloc(a_tmp, sizeof(u32) * qs->len, false);
+    u32 cnt_tex[TEXTURES_MAX] = {};
+    u32 level_max = 0;
+
+    for (s32 ty = 0; ty < DAMAGE_TILES_Y_MAX; ++ty) {
+        for (s32 tx = 0; tx < DAMAGE_TILES_X_MAX; ++tx) {
+            qs->level_tex[ty][tx] = QUAD_LEVEL_EMPTY;
+        }
+    }
+    for (QuadChunk *c = qs->first; c != NULL; c = c->next) {
+        for (u32 i = 0; i < c->len; ++i) {
+            Quad *q = c->quads + i;
+            DamageFootprint fp = QuadFootprint(q, width, height);
+            if (fp.tx1 < fp.tx0) {
+                continue;
+            }
+            u32 level = QuadLevel(qs, fp, q->texture);
+            level_max = MaxU32(level_max, level);
+            levels[visible_cnt] = level;
+            visible[visible_cnt++] = q;
+            cnt_tex[q->texture]++;
+        }
+        if (c == qs->cur) {
+            break;
+        }
+    }
+
+    // counting sort by texture, then stably by level
+    u32 *by_tex = (u32*) ArenaAlloc(a_tmp, sizeof(u32) * visible_cnt, false);
+    u32 at = 0;
+    for (u32 t = 0; t < g_textures_cnt; ++t) {
+        u32 cnt = cnt_tex[t];
+        cnt_tex[t] = at;
+        at += cnt;
+    }
+    for (u32 i = 0; i < visible_cnt; ++i) {
+        by_tex[cnt_tex[visible[i]->texture]++] = i;
+    }
+
+    u32 *first_level = (u32*) ArenaAlloc(a_tmp, sizeof(u32) * (level_max + 1), true);
+    for (u32 i = 0; i < visible_cnt; ++i) {
+        first_level[levels[i]]++;
+    }
+    at = 0;
+    for (u32 l = 0; l <= level_max; ++l) {
+        u32 cnt = first_level[l];
+        first_level[l] = at;
+        at += cnt;
+    }
+    Array<Quad> dest = InitArray<Quad>(a_tmp, visible_cnt);
+    dest.len = visible_cnt;
+    for (u32 i = 0; i < visible_cnt; ++i) {
+        u32 k = by_tex[i];
+        dest.arr[first_level[levels[k]]++] = *visible[k];
+    }
+
+    qs->pushed = qs->len;
+    qs->culled = qs->len - visible_cnt;
+    qs->bytes_touched = sizeof(Quad) * ((u64) qs->len * 2 + visible_cnt);
+    return dest;
+}
+
+void RenderStatsPrint() {
+    // last frame's quad and overdraw counters, one line
+    DamageTracker *dmg = &g_damage;
+    QuadStream *qs = &g_quad_stream;
+    f64 overdraw = dmg->pixels_redrawn ? (f64) dmg->pixels_written / dmg->pixels_redrawn : 0;
+    printf("quads %u (%u culled), %llu KB touched, tiles %u, px redrawn %llu, written %llu (overdraw %.2f), occluded %llu\n",
+        qs->pushed, qs->culled, (unsigned long long) qs->bytes_touched / 1024, dmg->dirty_cnt,
+        (unsigned long long) dmg->pixels_redrawn, (unsigned long long) dmg->pixels_written, overdraw, (unsigned long long) dmg->pixels_occluded);
+}
+
+void QuadBufferBlitAndClear(MArena *a_tmp, ImageRGBA render_target) {
+    QuadStream *qs = &g_quad_stream;
+    Array<Quad> quads = QuadStreamGather(a_tmp, qs, render_target.width, render_target.height);
+
+    DamageUpdate(a_tmp, quads, render_target.width, render_target.height);
+    DamageRedraw(quads, &render_target);
+    qs->bytes_touched += sizeof(Quad) * ((u64) quads.len + g_damage.bin_first[g_damage.dirty_cnt]);
+
+    QuadStreamClear(qs);
 }
 
 
@@ -2792,12 +3768,97 @@ List<QuadHexaVertex> LayoutTextAutowrap(MArena *a_dest, FontAtlas *plt, Str txt,
     return quads;
 }
 
-s32 TextLineWidth(FontAtlas *plt, Str txt) {
+//
+//  Shaped text
+//
+//  Laying out a label walks the glyph advances and cooks a quad per glyph, and a
+//  widget label is measured and then plotted every frame. A shaped run keeps the
+//  glyph quads relative to the text's top-left corner plus the text extents, keyed
+//  by the text and the font atlas, which is one font at one size. Plotting a cached
+//  text is a copy of its quads, offset and colored on the way into the quad buffer.
+//  Texts longer than TEXT_CACHE_LEN_MAX are laid out every time.
+
+
+#define TEXT_CACHE_SLOTS 256
+#define TEXT_CACHE_PROBE 8
+#define TEXT_CACHE_LEN_MAX 64
+
+struct ShapedText {
+    u64 hash;       // 0 for a free slot
+    u64 font_key;
+    u64 last_used;
+    u32 len;
+    char text[TEXT_CACHE_LEN_MAX];
+    s32 w;
+    s32 h;
+    u32 quads_cnt;
+    Quad quads[TEXT_CACHE_LEN_MAX];
+};
+
+struct TextCache {
+    ShapedText *slots;
+    u64 uses;
+    u64 hits;
+    u64 misses;
+};
+
+static TextCache g_text_cache;
+
+void TextCacheInit(MArena *a_life) {
+    g_text_cache.slots = (ShapedText*) ArenaAlloc(a_life, sizeof(ShapedText) * TEXT_CACHE_SLOTS, true);
+}
+
+void TextCacheInvalidate() {
+    // call when fonts are (re-)loaded
+    if (g_text_cache.slots == NULL) {
+        return;
+    }
+    for (u32 i = 0; i < TEXT_CACHE_SLOTS; ++i) {
+        g_text_cache.slots[i].hash = 0;
+        g_text_cache.slots[i].last_used = 0;
+    }
+}
+
+ShapedText *TextShape(FontAtlas *plt, Str txt) {
+    // the shaped run of txt, laid out on a miss, NULL if txt can't be cached
+    TextCache *tc = &g_text_cache;
+    if (tc->slots == NULL || txt.len > TEXT_CACHE_LEN_MAX) {
+        return NULL;
+    }
+
+    u64 font_key = plt->GetKey();
+    u64 hash = (HashStringValue(txt) ^ (font_key * 0x9e3779b97f4a7c15ull)) | 1;
+    u32 slot = (u32) (hash >> 32) % TEXT_CACHE_SLOTS;
+
+    // a hit, or the least recently used slot of the probe window
+    ShapedText *victim = NULL;
+    for (u32 i = 0; i < TEXT_CACHE_PROBE; ++i) {
+        ShapedText *st = tc->slots + (slot + i) % TEXT_CACHE_SLOTS;
+        if (st->hash == hash && st->font_key == font_key && st->len == txt.len && memcmp(st->text, txt.str, txt.len) == 0) {
+            st->last_used = ++tc->uses;
+            tc->hits++;
+            return st;
+        }
+        if (victim == NULL || st->last_used < victim->last_used) {
+            victim = st;
+        }
+    }
+    tc->misses++;
+
+    ShapedText *st = victim;
+    st->hash = hash;
+    st->font_key = font_key;
+    st->last_used = ++tc->uses;
+    st->len = txt.len;
+    memcpy(st->text, txt.str, txt.len);
+    st->h = plt->ln_measured;
+    st->quads_cnt = 0;
+
     s32 pt_x = 0;
+    s32 pt_y = plt->GetLineBaseOffset();
     s32 w_space = plt->advance_x.lst[' '];
-
+    u16 texture = TextureIndex(font_key);
     for (u32 i = 0; i < txt.len; ++i) {
-        // while words
         char c = txt.str[i];
 
         if (c == ' ') {
@@ -2807,37 +3868,46 @@ s32 TextLineWidth(FontAtlas *plt, Str txt) {
         if (IsAscii(c) == false) {
             continue;
         }
-
+        st->quads[st->quads_cnt++] = QuadOffset(plt->cooked.lst + c, pt_x, pt_y, COLOR_BLACK, texture);
         pt_x += plt->advance_x.lst[c];
     }
+    st->w = pt_x;
 
-    return pt_x;
-}
-s32 TextLineHeight(FontAtlas *plt) {
-    return plt->ln_measured;
+    return st;
 }
 
-void TextPositionLine(Str txt, s32 box_l, s32 box_t, s32 box_w, s32 box_h, s32 align_horiz, s32 align_vert, s32 *txt_l, s32 *txt_t, s32 *txt_w, s32 *txt_h) {
-    FontAtlas *plt = g_text_plotter;
-
-    *txt_w = 0;
-    *txt_h = plt->ln_measured; // single-line height
+s32 TextLineWidth(FontAtlas *plt, Str txt) {
+    ShapedText *st = TextShape(plt, txt);
+    if (st) {
+        return st->w;
+    }
 
+    s32 pt_x = 0;
     s32 w_space = plt->advance_x.lst[' '];
-    for (u32 i = 0; i < txt.len; ++i) {
 
+    for (u32 i = 0; i < txt.len; ++i) {
+        // while words
         char c = txt.str[i];
+
         if (c == ' ') {
-            *txt_w += w_space;
+            pt_x += w_space;
             continue;
         }
         if (IsAscii(c) == false) {
             continue;
         }
 
-        *txt_w += plt->advance_x.lst[c];
+        pt_x += plt->advance_x.lst[c];
     }
 
+    return pt_x;
+}
+s32 TextLineHeight(FontAtlas *plt) {
+    return plt->ln_measured;
+}
+
+void TextAlignBox(s32 box_l, s32 box_t, s32 box_w, s32 box_h, s32 align_horiz, s32 align_vert, s32 *txt_l, s32 *txt_t, s32 *txt_w, s32 *txt_h) {
+    // places a txt_w by txt_h text rect in the box
     s32 box_x = box_l + box_w / 2;
     s32 box_y = box_t + box_h / 2;
 
@@ -2870,6 +3940,14 @@ void TextPositionLine(Str txt, s32 box_l, s32 box_t, s32 box_w, s32 box_h, s32 a
     *txt_t = txt_y - *txt_h / 2;
 }
 
+void TextPositionLine(Str txt, s32 box_l, s32 box_t, s32 box_w, s32 box_h, s32 align_horiz, s32 align_vert, s32 *txt_l, s32 *txt_t, s32 *txt_w, s32 *txt_h) {
+    FontAtlas *plt = g_text_plotter;
+
+    *txt_w = TextLineWidth(plt, txt);
+    *txt_h = plt->ln_measured; // single-line height
+    TextAlignBox(box_l, box_t, box_w, box_h, align_horiz, align_vert, txt_l, txt_t, txt_w, txt_h);
+}
+
 
 // TODO: use floats for character rendering
 
@@ -2879,13 +3957,21 @@ void TextPlot(Str txt, s32 box_l, s32 box_t, s32 box_w, s32 box_h, s32 *sz_x, s3
 
     s32 txt_l;
     s32 txt_t;
+    ShapedText *st = TextShape(plt, txt);
+    if (st) {
+        *sz_x = st->w;
+        *sz_y = st->h;
+        TextAlignBox(box_l, box_t, box_w, box_h, 0, 0, &txt_l, &txt_t, sz_x, sz_y);
+        QuadBufferPushOffset(st->quads, st->quads_cnt, txt_l, txt_t, color);
+        return;
+    }
     TextPositionLine(txt, box_l, box_t, box_w, box_h, 0, 0, &txt_l, &txt_t, sz_x, sz_y);
 
     // position the quads
     s32 pt_x = txt_l;
     s32 pt_y = txt_t + plt->GetLineBaseOffset();
     s32 w_space = plt->advance_x.lst[' '];
-    u64 plt_key = plt->GetKey();
+    u16 plt_texture = TextureIndex(plt->GetKey());
 
     for (u32 i = 0; i < txt.len; ++i) {
         char c = txt.str[i];
@@ -2898,7 +3984,7 @@ void TextPlot(Str txt, s32 box_l, s32 box_t, s32 box_w, s32 box_h, s32 *sz_x, s3
             continue;
         }
 
-        QuadHexaVertex q = QuadOffset(plt->cooked.lst + c, pt_x, pt_y, color, plt_key);
+        Quad q = QuadOffset(plt->cooked.lst + c, pt_x, pt_y, color, plt_texture);
         pt_x += plt->advance_x.lst[c];
         QuadBufferPush(q);
     }
@@ -2923,8 +4009,9 @@ void PanelPlot( f32 l, f32 t, f32 w, f32 h, f32 thic_border, Color col_border =
         return;
     }
 
-    QuadBufferPush(QuadCookSolid(w, h, l, t, col_border));
-    QuadBufferPush(QuadCookSolid(w - 2*thic_border, h - 2*thic_border, l + thic_border, t + thic_border, col_pnl));
+    Quad border = QuadCookSolid(w, h, l, t, col_border);
+    Quad panel = QuadCookSolid(w - 2*thic_border, h - 2*thic_border, l + thic_border, t + thic_border, col_pnl);
+    QuadBufferPushFramed(border, panel);
 }
 
 
@@ -3794,90 +4881,141 @@ void UI_Pop() {
 #define __RASTER_H__
 
 
-inline
-bool _CullScreenCoords(u32 pos_x, u32 pos_y, u32 w, u32 h) {
-    // returns true if the coordinate is out of range
-    bool not_result = pos_x >= 0 && pos_x < w && pos_y >= 0 && pos_y < h;
-    return !not_result;
-}
+//
+//  Lines
+//
+//  Integer Bresenham. Along the major axis, step i of a line from a to b lands at
+//  minor offset (2 * i * d_minor + d_major) / (2 * d_major), i.e. rounded to the
+//  nearest pixel. Clipping solves that for the first and last step inside the
+//  image, so a clipped line has exactly the pixels of the unclipped one that are
+//  on screen. Horizontal lines are span fills, vertical ones a column loop.
+//
+//  The functions taking a raw buffer draw around the quad buffer. Into the screen,
+//  they go between CbuiFrameRasterize(true) and CbuiFramePresent(), into ImageBufferGet().
 
-void RenderLineRGBA(u8* image_buffer, u16 w, u16 h, s16 ax, s16 ay, s16 bx, s16 by, Color color) {
 
-    // initially working from a to b
-    // there are four cases:
-    // 1: slope <= 1, ax < bx
-    // 2: slope <= 1, ax > bx 
-    // 3: slope > 1, ay < by
-    // 4: slope > 1, ay > by 
+struct Line {
+    s32 ax;
+    s32 ay;
+    s32 bx;
+    s32 by;
+    Color color;
+};
 
-    f32 slope_ab = (f32) (by - ay) / (bx - ax);
+inline
+s64 FloorDivS64(s64 a, s64 b) {
+    // b > 0
+    return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
 
-    if (abs(slope_ab) <= 1) {
-        // draw by x
-        f32 slope = slope_ab;
+inline
+s64 CeilDivS64(s64 a, s64 b) {
+    // b > 0
+    return -FloorDivS64(-a, b);
+}
+
+void RenderLineMajor(Color *img, s32 stride_maj, s32 stride_min, s32 len_maj, s32 len_min, s32 a_maj, s32 a_min, s32 d_maj, s32 d_min, s32 s_min, Color color) {
+    // d_maj >= d_min > 0, the line runs from a towards +major and s_min * minor
+    s64 two_maj = 2 * (s64) d_maj;
+    s64 two_min = 2 * (s64) d_min;
+
+    // steps with the major coordinate on screen
+    s64 i0 = MaxS64(0, - (s64) a_maj);
+    s64 i1 = MinS64(d_maj, (s64) len_maj - 1 - a_maj);
+
+    // steps with the minor offset in [k_lo, k_hi], i.e. the minor coordinate on screen
+    s64 k_lo = (s_min > 0) ? - (s64) a_min : (s64) a_min - (len_min - 1);
+    s64 k_hi = (s_min > 0) ? (s64) len_min - 1 - a_min : (s64) a_min;
+    i0 = MaxS64(i0, CeilDivS64(two_maj * k_lo - d_maj, two_min));
+    i1 = MinS64(i1, FloorDivS64(two_maj * (k_hi + 1) - d_maj - 1, two_min));
+    if (i0 > i1) {
+        return;
+    }
 
-        // swap?
-        if (ax > bx) {
-            u16 swapx = ax;
-            u16 swapy = ay;
+    s64 num = two_min * i0 + d_maj;
+    s64 off = num / two_maj;
+    s64 rem = num % two_maj;
+    Color *p = img + (a_maj + i0) * stride_maj + (a_min + s_min * off) * stride_min;
+    s32 step_min = s_min * stride_min;
 
-            ax = bx;
-            ay = by;
-            bx = swapx;
-            by = swapy;
+    for (s64 i = i0; i <= i1; ++i) {
+        *p = color;
+        p += stride_maj;
+        rem += two_min;
+        if (rem >= two_maj) {
+            rem -= two_maj;
+            p += step_min;
         }
+    }
+}
 
-        s16 x, y;
-        u32 pix_idx;
-        for (s32 i = 0; i <= bx - ax; ++i) {
-            x = ax + i;
-            y = ay + (s16) floor(slope * i);
+void RenderLine(ImageRGBA *img, s32 ax, s32 ay, s32 bx, s32 by, Color color) {
+    s32 w = img->width;
+    s32 h = img->height;
 
-            if (_CullScreenCoords(x, y, w, h)) {
-                continue;
+    // horizontal
+    if (ay == by) {
+        s32 x0 = MaxS32(0, MinS32(ax, bx));
+        s32 x1 = MinS32(w - 1, MaxS32(ax, bx));
+        if (ay >= 0 && ay < h && x0 <= x1) {
+            SpanFill(img->img + ay * w + x0, x1 - x0 + 1, color);
+        }
+        return;
+    }
+
+    // vertical
+    if (ax == bx) {
+        s32 y0 = MaxS32(0, MinS32(ay, by));
+        s32 y1 = MinS32(h - 1, MaxS32(ay, by));
+        if (ax >= 0 && ax < w) {
+            Color *p = img->img + y0 * w + ax;
+            for (s32 y = y0; y <= y1; ++y) {
+                *p = color;
+                p += w;
             }
+        }
+        return;
+    }
 
-            pix_idx = x + y*w;
-            image_buffer[4 * pix_idx + 0] = color.r;
-            image_buffer[4 * pix_idx + 1] = color.g;
-            image_buffer[4 * pix_idx + 2] = color.b;
-            image_buffer[4 * pix_idx + 3] = color.a;
+    s32 dx = abs(bx - ax);
+    s32 dy = abs(by - ay);
+    if (dx >= dy) {
+        if (ax > bx) {
+            s32 swap_x = ax;
+            s32 swap_y = ay;
+            ax = bx;
+            ay = by;
+            bx = swap_x;
+            by = swap_y;
         }
+        RenderLineMajor(img->img, 1, w, w, h, ax, ay, dx, dy, (by > ay) ? 1 : -1, color);
     }
     else {
-        // draw by y
-        f32 slope_inv = 1 / slope_ab;
-
-        // swap a & b ?
         if (ay > by) {
-            u16 swapx = ax;
-            u16 swapy = ay;
-
+            s32 swap_x = ax;
+            s32 swap_y = ay;
             ax = bx;
             ay = by;
-            bx = swapx;
-            by = swapy;
+            bx = swap_x;
+            by = swap_y;
         }
+        RenderLineMajor(img->img, w, 1, h, w, ay, ax, dy, dx, (bx > ax) ? 1 : -1, color);
+    }
+}
 
-        s16 x, y;
-        u32 pix_idx;
-        for (u16 i = 0; i <= by - ay; ++i) {
-            y = ay + i;
-            x = ax + (s16) floor(slope_inv * i);
-
-            if (_CullScreenCoords(x, y, w, h)) {
-                continue;
-            }
-
-            pix_idx = x + y*w;
-            image_buffer[4 * pix_idx + 0] = color.r;
-            image_buffer[4 * pix_idx + 1] = color.g;
-            image_buffer[4 * pix_idx + 2] = color.b;
-            image_buffer[4 * pix_idx + 3] = color.a;
-        }
+void RenderLines(ImageRGBA *img, Array<Line> lines) {
+    // grid lines, wireframes, debug overlays
+    for (u32 i = 0; i < lines.len; ++i) {
+        Line l = lines.arr[i];
+        RenderLine(img, l.ax, l.ay, l.bx, l.by, l.color);
     }
 }
 
+void RenderLineRGBA(u8* image_buffer, u16 w, u16 h, s32 ax, s32 ay, s32 bx, s32 by, Color color) {
+    ImageRGBA img = InitImageRGBA(w, h, image_buffer);
+    RenderLine(&img, ax, ay, bx, by, color);
+}
+
 inline
 u32 GetXYIdx(f32 x, f32 y, u32 stride) {
     u32 idx = floor(x) + stride * floor(y);
@@ -3922,35 +5060,193 @@ void RenderLineSegment(u8 *image_buffer, Matrix4f view, Matrix4f proj, Vector3f
     Vector3f p1_cam = TransformInversePoint(view, p1);
     Vector3f p2_cam = TransformInversePoint(view, p2);
 
-    Ray view_plane = { Vector3f { 0, 0, 0.1 }, Vector3f { 0, 0, 1 } };
+    Ray view_plane = { Vector3f { 0, 0, 0.1 }, Vector3f { 0, 0, 1 } };
+
+    bool visible1 = PointSideOfPlane(p1_cam, view_plane);
+    bool visible2 = PointSideOfPlane(p2_cam, view_plane);
+
+    if (visible1 == true || visible2 == true) {
+        if (visible1 == false && visible2 == true) {
+            Ray segment = { p2_cam, p1_cam - p2_cam };
+            f32 t = 0;
+            p1_cam = RayPlaneIntersect(segment, view_plane.pos, view_plane.dir, &t);
+        }
+        else if (visible1 == true && visible2 == false) {
+            Ray segment = { p1_cam, p2_cam - p1_cam };
+            f32 t = 0;
+            p2_cam = RayPlaneIntersect(segment, view_plane.pos, view_plane.dir, &t);
+        }
+
+        Vector3f p1_ndc = TransformPerspective(proj, p1_cam);
+        Vector3f p2_ndc = TransformPerspective(proj, p2_cam);
+
+        Vector2f a = {};
+        a.x = (p1_ndc.x + 1) / 2 * w;
+        a.y = (p1_ndc.y + 1) / 2 * h;
+        Vector2f b = {};
+        b.x = (p2_ndc.x + 1) / 2 * w;
+        b.y = (p2_ndc.y + 1) / 2 * h;
+
+        RenderLineRGBA(image_buffer, w, h, a.x, a.y, b.x, b.y, color);
+    }
+}
+
+
+#endif
+
+
+#ifndef __FRAME_PACER_H__
+#define __FRAME_PACER_H__
+
+
+//
+//  Frame pacing
+//
+//  Holds frames to a target rate on the monotonic clock. The wait sleeps while the
+//  deadline is further off than the sleep can be trusted to wake up, then spins the
+//  rest, so the CPU idles most of the frame and frames still go out on time. The
+//  spin margin follows an estimate of the oversleep, which jumps up to a worse one at
+//  once and decays over seconds. It is small where the OS sleeps precisely, and up to
+//  the whole period where it sleeps too coarsely for the frame rate. On Windows the
+//  scheduler tick is raised to 1 ms while the pacer waits. Deadlines step by the frame
+//  period, a late frame doesn't shift the ones after it, and the schedule restarts
+//  when a frame is more than a period late. With vsync the buffer swap paces and the
+//  wait is skipped.
+
+
+#if WINDOWS
+#include <mmsystem.h>
+#endif
+
+
+#define FRAME_PACER_HZ_DEFAULT 120
+#define FRAME_PACER_SPIN_MIN_US 200
+#define FRAME_PACER_OVERSLEEP_INIT_US 2000  // assumed until measured
+#define FRAME_PACER_OVERSLEEP_DECAY 256     // per wait, the estimate loses 1/DECAY of itself
+#define FRAME_HIST_BUCKET_US 100
+#define FRAME_HIST_BUCKETS 1000 // 100 ms, longer frames go into the last bucket
+
+
+struct FrameHistogram {
+    u32 buckets[FRAME_HIST_BUCKETS];
+    u64 cnt;
+    u64 max_us;
+
+    void Add(u64 dt_us) {
+        u64 idx = MinU64(dt_us / FRAME_HIST_BUCKET_US, FRAME_HIST_BUCKETS - 1);
+        buckets[idx]++;
+        cnt++;
+        max_us = MaxU64(max_us, dt_us);
+    }
+    u64 Percentile(f32 pct) {
+        // upper edge of the bucket the percentile falls in [us]
+        u64 rank = (u64) ceil(cnt * pct / 100.0f);
+        u64 sum = 0;
+        for (u32 i = 0; i < FRAME_HIST_BUCKETS; ++i) {
+            sum += buckets[i];
+            if (sum >= rank && sum > 0) {
+                return MinU64((u64) (i + 1) * FRAME_HIST_BUCKET_US, max_us);
+            }
+        }
+        return max_us;
+    }
+    void Print(const char *label) {
+        printf("%s: %llu frames, p50 %.1f ms, p99 %.1f ms, max %.1f ms\n", label, (unsigned long long) cnt,
+            Percentile(50) / 1000.0f, Percentile(99) / 1000.0f, max_us / 1000.0f);
+    }
+};
+
+struct FramePacer {
+    u32 target_hz;      // 0 runs unthrottled
+    bool vsync;
+    u64 period_us;
+    u64 t_deadline;     // when the next frame goes out
+    u64 oversleep_us;   // estimated, how late a sleep may wake up
+    u64 t_waited_us;    // in total, sleeping and spinning
+    FrameHistogram hist;
+};
+
+static FramePacer g_frame_pacer;
+
+void FramePacerTimerResolution(bool raise) {
+    // Windows sleeps in ~15.6 ms scheduler ticks unless 1 ms ones are asked for, system wide
+    #if WINDOWS
+    static bool raised;
+    if (raise != raised) {
+        if (raise) {
+            timeBeginPeriod(1);
+        }
+        else {
+            timeEndPeriod(1);
+        }
+        raised = raise;
+    }
+    #endif
+}
+
+void FramePacerInit(u32 target_hz, bool vsync) {
+    FramePacer *fp = &g_frame_pacer;
+    *fp = {};
+    fp->target_hz = target_hz;
+    fp->vsync = vsync;
+    fp->period_us = target_hz ? 1000000 / target_hz : 0;
+    fp->oversleep_us = FRAME_PACER_OVERSLEEP_INIT_US;
+    FramePacerTimerResolution(vsync == false && target_hz != 0);
+}
+
+void FramePacerShutdown() {
+    FramePacerTimerResolution(false);
+}
+
+void FramePacerWait() {
+    // blocks until this frame is due
+    FramePacer *fp = &g_frame_pacer;
+    if (fp->vsync || fp->period_us == 0) {
+        return;
+    }
 
-    bool visible1 = PointSideOfPlane(p1_cam, view_plane);
-    bool visible2 = PointSideOfPlane(p2_cam, view_plane);
+    u64 t = ReadMonotonicTimerMySec();
+    u64 t_start = t;
+    if (fp->t_deadline == 0 || t > fp->t_deadline + fp->period_us) {
+        fp->t_deadline = t;
+    }
 
-    if (visible1 == true || visible2 == true) {
-        if (visible1 == false && visible2 == true) {
-            Ray segment = { p2_cam, p1_cam - p2_cam };
-            f32 t = 0;
-            p1_cam = RayPlaneIntersect(segment, view_plane.pos, view_plane.dir, &t);
-        }
-        else if (visible1 == true && visible2 == false) {
-            Ray segment = { p1_cam, p2_cam - p1_cam };
-            f32 t = 0;
-            p2_cam = RayPlaneIntersect(segment, view_plane.pos, view_plane.dir, &t);
+    // sleep, learning how far past the asked time it wakes up, don't if it can't be
+    // trusted within a period
+    u64 spin_us = MaxU64(FRAME_PACER_SPIN_MIN_US, fp->oversleep_us + fp->oversleep_us / 2);
+    spin_us = MinU64(spin_us, fp->period_us);
+    u64 oversleep_us = 0;
+    while (fp->t_deadline > t + spin_us) {
+        u64 sleep_us = fp->t_deadline - t - spin_us;
+        XSleepMySec(sleep_us);
+        u64 t_woke = ReadMonotonicTimerMySec();
+        if (t_woke - t > sleep_us) {
+            oversleep_us = MaxU64(oversleep_us, t_woke - t - sleep_us);
         }
+        t = t_woke;
+    }
 
-        Vector3f p1_ndc = TransformPerspective(proj, p1_cam);
-        Vector3f p2_ndc = TransformPerspective(proj, p2_cam);
-
-        Vector2f a = {};
-        a.x = (p1_ndc.x + 1) / 2 * w;
-        a.y = (p1_ndc.y + 1) / 2 * h;
-        Vector2f b = {};
-        b.x = (p2_ndc.x + 1) / 2 * w;
-        b.y = (p2_ndc.y + 1) / 2 * h;
+    // jump up to a worse oversleep at once, come back down slowly, so a sleep too
+    // coarse for the period is only tried again every few seconds. Rounded down, a small
+    // estimate still decays all the way.
+    u64 decayed_us = fp->oversleep_us * (FRAME_PACER_OVERSLEEP_DECAY - 1) / FRAME_PACER_OVERSLEEP_DECAY;
+    fp->oversleep_us = MaxU64(oversleep_us, decayed_us);
 
-        RenderLineRGBA(image_buffer, w, h, a.x, a.y, b.x, b.y, color);
+    // spin the rest
+    while (t < fp->t_deadline) {
+        #if SIMD_X64
+        _mm_pause();
+        #endif
+        t = ReadMonotonicTimerMySec();
     }
+
+    fp->t_deadline += fp->period_us;
+    fp->t_waited_us += t - t_start;
+}
+
+void FramePacerMark(u64 dt_us) {
+    // a frame's start-to-start time
+    g_frame_pacer.hist.Add(dt_us);
 }
 
 
@@ -3966,6 +5262,7 @@ void RenderLineSegment(u8 *image_buffer, Matrix4f view, Matrix4f proj, Vector3f
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include <atomic>
 
 
 //
@@ -4015,12 +5312,46 @@ void ShaderProgramLink(GLuint *program, const GLchar *vsh_src, const GLchar *fsh
     glUseProgram(*program);
 }
 
+
+//
+//  Screen
+//
+//  The frame is rasterized on the CPU and uploaded into one texture drawn over the
+//  window, only the damage rects each frame. Where buffer storage is available the
+//  rasterizer draws straight into a ring of persistently mapped pixel buffer slots,
+//  and the texture is updated from the slot, so the upload happens in the driver
+//  while the next frame is rasterized into the next slot. A fence per slot keeps a
+//  slot from being drawn into before its upload is done. Slots hold stale pixels
+//  outside the current damage, which is fine: damaged tiles are redrawn in full,
+//  and only they are uploaded. A frame to be drawn into directly is damaged all over,
+//  so none of it is stale. Without buffer storage the frame is drawn into the
+//  image buffer and uploaded from client memory.
+//
+//  The texture only grows, in SCREEN_TEX_STEP steps, and the frame sits in its top
+//  left corner. Most resizes just change the viewport and the texture coordinate
+//  scale, dragging a window edge doesn't reallocate it every time.
+
+
+#define SCREEN_PBO_SLOTS 3
+#define SCREEN_TEX_STEP 256
+
 struct ScreenProgram {
     // draws a texture to the screen
     GLuint program;
     GLuint vao;
     GLuint vbo;
     GLuint texture_id;
+    u32 tex_width;
+    u32 tex_height;
+    GLint uv_scale_loc;
+
+    // pixel buffer ring
+    bool pbo_enabled;
+    GLuint pbo;
+    u8 *pbo_mem;        // persistently mapped, SCREEN_PBO_SLOTS slots
+    u32 pbo_slot_sz;
+    u32 pbo_slot;       // drawn into this frame
+    GLsync pbo_fences[SCREEN_PBO_SLOTS];
 
     const GLchar* vert_src = R"glsl(
         #version 330 core
@@ -4028,11 +5359,12 @@ struct ScreenProgram {
         in vec2 position;
         in vec2 tex_coord;
         out vec2 coord;
+        uniform vec2 uv_scale;
 
         void main()
         {
             gl_Position = vec4(position, 0.0, 1.0);
-            coord = tex_coord;
+            coord = tex_coord * uv_scale;
         }
     )glsl";
     const GLchar* frag_src = R"glsl(
@@ -4048,12 +5380,89 @@ struct ScreenProgram {
         }
     )glsl";
 
-    void SetSize(u8* imgbuffer, u32 width, u32 height) {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, imgbuffer);
+    void SetSize(u32 width, u32 height) {
+        // the frame's content is undefined after this, it needs uploading in full
+        if (width > tex_width || height > tex_height) {
+            tex_width = MaxU32(tex_width, (width + SCREEN_TEX_STEP - 1) / SCREEN_TEX_STEP * SCREEN_TEX_STEP);
+            tex_height = MaxU32(tex_height, (height + SCREEN_TEX_STEP - 1) / SCREEN_TEX_STEP * SCREEN_TEX_STEP);
+            glBindTexture(GL_TEXTURE_2D, texture_id);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex_width, tex_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        }
         glViewport(0, 0, width, height);
+        glUseProgram(program);
+        glUniform2f(uv_scale_loc, (f32) width / tex_width, (f32) height / tex_height);
+    }
+
+    void PboWait(u32 slot) {
+        GLsync fence = pbo_fences[slot];
+        if (fence == 0) {
+            return;
+        }
+        GLenum status;
+        do {
+            status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100 * 1000 * 1000);
+        }
+        while (status == GL_TIMEOUT_EXPIRED);
+        glDeleteSync(fence);
+        pbo_fences[slot] = 0;
+    }
+
+    void PboRelease() {
+        if (pbo == 0) {
+            return;
+        }
+        for (u32 i = 0; i < SCREEN_PBO_SLOTS; ++i) {
+            PboWait(i);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, &pbo);
+        pbo = 0;
+        pbo_mem = NULL;
+        pbo_slot_sz = 0;
+    }
+
+    void PboReserve(u32 slot_sz) {
+        // (re-)creates the ring with room for slot_sz bytes per slot
+        PboRelease();
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glGenBuffers(1, &pbo);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        glBufferStorage(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr) slot_sz * SCREEN_PBO_SLOTS, NULL, flags);
+        pbo_mem = (u8*) glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr) slot_sz * SCREEN_PBO_SLOTS, flags);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        pbo_slot_sz = slot_sz;
+        pbo_slot = 0;
+
+        if (pbo_mem == NULL) {
+            // no mapping, stay with client memory uploads
+            glDeleteBuffers(1, &pbo);
+            pbo = 0;
+            pbo_slot_sz = 0;
+            pbo_enabled = false;
+        }
+    }
+
+    u8 *AcquireFrame(u8* imgbuffer, u32 width, u32 height) {
+        // where to rasterize this frame: the next free ring slot, or imgbuffer without a ring
+        if (pbo_enabled == false) {
+            return imgbuffer;
+        }
+        u32 frame_sz = 4 * width * height;
+        if (frame_sz > pbo_slot_sz) {
+            PboReserve(frame_sz);
+            if (pbo_enabled == false) {
+                return imgbuffer;
+            }
+        }
+        pbo_slot = (pbo_slot + 1) % SCREEN_PBO_SLOTS;
+        PboWait(pbo_slot);
+        return pbo_mem + (u64) pbo_slot * pbo_slot_sz;
     }
 
-    void Draw(u8* imgbuffer, u32 width, u32 height) {
+    void Draw(u8* imgbuffer, u32 width, u32 height, Rect *rects, u32 rects_cnt) {
+        // uploads only the given rects, straight out of the full-width frame
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f );
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -4061,8 +5470,28 @@ struct ScreenProgram {
         glBindVertexArray(vao);
         glBindBuffer(GL_ARRAY_BUFFER, vbo);
 
+        // a frame in the ring is uploaded by offset into the bound pixel buffer
+        bool from_pbo = pbo_mem != NULL && imgbuffer >= pbo_mem && imgbuffer < pbo_mem + (u64) pbo_slot_sz * SCREEN_PBO_SLOTS;
+        u8 *base = imgbuffer;
+        if (from_pbo) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+            base = (u8*) (imgbuffer - pbo_mem);
+        }
+
         glBindTexture(GL_TEXTURE_2D, texture_id);
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, imgbuffer);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, width);
+        for (u32 i = 0; i < rects_cnt; ++i) {
+            Rect r = rects[i];
+            u8 *src = base + 4 * (r.top * width + r.left);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, r.left, r.top, r.width, r.height, GL_RGBA, GL_UNSIGNED_BYTE, src);
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+        if (from_pbo) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            u32 slot = (u32) ((imgbuffer - pbo_mem) / pbo_slot_sz);
+            pbo_fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
 
         u32 nverts = 4;
         glDrawArrays(GL_TRIANGLE_STRIP, 0, nverts);
@@ -4088,7 +5517,9 @@ ScreenProgram ScreenProgramInit(u8* imgbuffer, u32 width, u32 height) {
     glUseProgram(prog.program);
     glBindVertexArray(prog.vao);
     glBindBuffer(GL_ARRAY_BUFFER, prog.vbo);
-    prog.SetSize(imgbuffer, width, height);
+    prog.pbo_enabled = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+    prog.uv_scale_loc = glGetUniformLocation(prog.program, "uv_scale");
+    prog.SetSize(width, height);
 
     // quad
     float sqreen_quad_verts[] = {
@@ -4193,8 +5624,60 @@ struct ActionKeys {
 };
 
 
+//
+//  Headless
+//
+//  Runs the platform with no window and no GL context, for CI and for benchmarking on
+//  boxes without a display. Frames still go through UI_FrameEnd and the rasterizer into
+//  the image buffer. Time advances by a fixed step per frame so runs are reproducible,
+//  key input comes from a script, and frames can be dumped to a PPM or raw RGBA stream.
+//
+//  Script lines are "<frame> press|release <key>", in frame order, with the key as a
+//  GLFW key code or a name: left, right, up, down, space, enter, esc, f1-f12, or a
+//  single letter or digit. Lines starting with # are skipped.
+
+
+#define HEADLESS_SCRIPT_MAX 4096
+#define HEADLESS_DT_US 16667
+
+
+struct PlafHeadlessCfg {
+    const char *script_path;    // scripted key input, optional
+    const char *dump_path;      // frame dump, raw RGBA if it ends in .raw, PPM otherwise
+    u64 frames_max;             // 0 stops after the frame of the last scripted key
+    u64 dt_us;                  // simulated frame time, 0 for HEADLESS_DT_US
+};
+
+struct HeadlessKey {
+    u64 frameno;
+    s32 key;
+    s32 action;
+};
+
+struct PlafHeadless {
+    u64 frames_max;
+    u64 dt_us;
+    u64 t_us;           // simulated clock
+    u64 frames;         // done so far
+
+    HeadlessKey *script;
+    u32 script_len;
+    u32 script_at;
+
+    FILE *dump;
+    bool dump_raw;
+    u8 *dump_row;
+
+    // wall clock frame times
+    u64 t_wall_start;
+    u64 t_wall_prev;
+    FrameHistogram hist;
+};
+
+
 struct PlafGlfw {
     GLFWwindow* window;
+    PlafHeadless *headless; // NULL with a window
     bool fullscreen;
     char *title;
 
@@ -4214,18 +5697,60 @@ struct PlafGlfw {
     s32 window_xpos;
     s32 window_ypos;
     u8 *image_buffer;
+    u8 *frame;          // rasterized into this frame, image_buffer or a pixel buffer slot
+    u32 events;         // input and window events in the last poll
+    u32 resize_width;   // latest framebuffer size reported, applied once per poll
+    u32 resize_height;
+    bool resize_pending;
+
+};
+
 
+//
+//  Key event queue
+//
+//  Timestamped key presses and releases in the order they arrived, for code that
+//  cares about more than the per-frame key flags. Single producer (KeyCallBack),
+//  single consumer, lock-free, so the producer may live on another thread.
+
+
+#define KEY_EVENT_QUEUE_SIZE 256 // power of two
+
+
+struct KeyEvent {
+    u64 t_us; // PlafTimeMySec() at arrival
+    s32 key; // GLFW_KEY_*
+    s32 action; // GLFW_PRESS or GLFW_RELEASE
 };
 
+struct KeyEventQueue {
+    std::atomic<u32> head; // next to read
+    std::atomic<u32> tail; // next to write
+    KeyEvent events[KEY_EVENT_QUEUE_SIZE];
+
+    bool Push(KeyEvent e) {
+        u32 t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == KEY_EVENT_QUEUE_SIZE) {
+            return false;
+        }
+        events[t & (KEY_EVENT_QUEUE_SIZE - 1)] = e;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+    bool Peek(KeyEvent *e) {
+        u32 h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        *e = events[h & (KEY_EVENT_QUEUE_SIZE - 1)];
+        return true;
+    }
+    void Pop() {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+};
 
-// CUSTOM EDITS FOR 
-// TESTRIS
-static bool testris_l_state;
-static bool testris_r_state;
-static bool testris_a_state;
-static bool testris_d_state;
-static bool testris_s_state;
-static bool testris_adown_state;
+static KeyEventQueue g_key_events;
 
 
 inline PlafGlfw *_GlfwWindowToUserPtr(GLFWwindow* window) {
@@ -4235,6 +5760,7 @@ inline PlafGlfw *_GlfwWindowToUserPtr(GLFWwindow* window) {
 
 void MouseButtonCallBack(GLFWwindow* window, int button, int action, int mods) {
     PlafGlfw *plaf = _GlfwWindowToUserPtr(window);
+    plaf->events++;
 
     // get button
     Button *btn = NULL;
@@ -4258,6 +5784,7 @@ void MouseButtonCallBack(GLFWwindow* window, int button, int action, int mods) {
 
 void MouseScrollCallBack(GLFWwindow* window, double xoffset, double yoffset) {
     PlafGlfw *plaf = _GlfwWindowToUserPtr(window);
+    plaf->events++;
 
     plaf->scroll.yoffset_acc += yoffset;
     if (yoffset > 0) {
@@ -4268,8 +5795,19 @@ void MouseScrollCallBack(GLFWwindow* window, double xoffset, double yoffset) {
     }
 }
 
+void CursorPosCallBack(GLFWwindow* window, double xpos, double ypos) {
+    // the position itself is read once per frame
+    _GlfwWindowToUserPtr(window)->events++;
+}
+
+void WindowRefreshCallBack(GLFWwindow* window) {
+    // the window needs presenting again, e.g. after being uncovered
+    _GlfwWindowToUserPtr(window)->events++;
+}
+
 void CharCallBack(GLFWwindow* window, u32 codepoint) {
     PlafGlfw *plf = _GlfwWindowToUserPtr(window);
+    plf->events++;
 
     if (codepoint >= 0 && codepoint < 128) {
         char c = (u8) codepoint;
@@ -4277,9 +5815,9 @@ void CharCallBack(GLFWwindow* window, u32 codepoint) {
     }
 }
 
-void KeyCallBack(GLFWwindow* window,  int key, int scancode, int action, int mods) {
-    PlafGlfw *plf = _GlfwWindowToUserPtr(window);
-
+void PlafKeyInput(PlafGlfw *plf, int key, int action, int mods, u64 t_us) {
+    // a key press or release, from the window or from a headless script
+    plf->events++;
     if (key == GLFW_KEY_LEFT_CONTROL || key == GLFW_KEY_LEFT_CONTROL) {
         plf->akeys.mod_ctrl = (action == GLFW_PRESS);
     }
@@ -4308,24 +5846,15 @@ void KeyCallBack(GLFWwindow* window,  int key, int scancode, int action, int mod
         }
         else if (key == GLFW_KEY_LEFT) {
             plf->akeys.left = true;
-
-            // TESTRIS
-            testris_l_state = true;
         }
         else if (key == GLFW_KEY_RIGHT) {
             plf->akeys.right = true;
-
-            // TESTRIS
-            testris_r_state = true;
         }
         else if (key == GLFW_KEY_UP) {
             plf->akeys.up = true;
         }
         else if (key == GLFW_KEY_DOWN) {
             plf->akeys.down = true;
-
-            // TESTRIS
-            testris_adown_state = true;
         }
         else if (key >= 290 && key <= 301) {
             // 290-301: F1 through F12
@@ -4341,57 +5870,63 @@ void KeyCallBack(GLFWwindow* window,  int key, int scancode, int action, int mod
         else if (key == 'Z' && mods == GLFW_MOD_CONTROL) {
             printf("ctr-Z\n");
         }
-
-        // TESTRIS
-        else if (key == 'a') {
-            testris_a_state = true;
-        }
-        else if (key == 'd') {
-            testris_d_state = true;
-        }
-        else if (key == 's') {
-            testris_s_state = true;
-        }
     }
 
-    // TESTRIS
-    if (action == GLFW_RELEASE) {
-        if (key == GLFW_KEY_LEFT) {
-            testris_l_state = false;
-        }
-        else if (key == GLFW_KEY_RIGHT) {
-            testris_r_state = false;
-        }
-        else if (key == GLFW_KEY_DOWN) {
-            testris_adown_state = false;
-        }
-        else if (key == 'a') {
-            testris_a_state = false;
-        }
-        else if (key == 'd') {
-            testris_d_state = false;
-        }
-        else if (key == 's') {
-            testris_adown_state = false;
-        }
+    // OS key repeats are left out, consumers time their own
+    if (action == GLFW_PRESS || action == GLFW_RELEASE) {
+        KeyEvent e = {};
+        e.t_us = t_us;
+        e.key = key;
+        e.action = action;
+        g_key_events.Push(e);
     }
 }
 
+void KeyCallBack(GLFWwindow* window,  int key, int scancode, int action, int mods) {
+    PlafKeyInput(_GlfwWindowToUserPtr(window), key, action, mods, ReadMonotonicTimerMySec());
+}
+
 void WindowResizeCallBack(GLFWwindow* window, int width, int height) {
+    // a drag sends many of these, only the last one per poll is applied
     PlafGlfw *plf = _GlfwWindowToUserPtr(window);
+    plf->events++;
 
-    plf->width = width;
-    plf->height = height;
-    plf->screen.SetSize(plf->image_buffer, width, height);
+    plf->resize_width = width;
+    plf->resize_height = height;
+    plf->resize_pending = true;
+}
+
+void PlafGlfwApplyResize(PlafGlfw* plf) {
+    if (plf->resize_pending == false) {
+        return;
+    }
+    plf->resize_pending = false;
+    if (plf->resize_width == 0 || plf->resize_height == 0) {
+        // minimized, keep the last size
+        return;
+    }
+    if (plf->resize_width == plf->width && plf->resize_height == plf->height) {
+        return;
+    }
+
+    plf->width = plf->resize_width;
+    plf->height = plf->resize_height;
+    plf->screen.SetSize(plf->width, plf->height);
+    DamageInvalidate();
 }
 
 
 static u8 *g_image_buffer;
+static u8 *g_image_frame; // being rasterized, image buffer or a pixel buffer slot, from acquire to present
 #define IMG_BUFF_CHANNELS 4
 #define IMG_BUFF_MAX_WIDTH 3840
 #define IMG_BUFF_MAX_HEIGHT 2160
 u8 *ImageBufferGet() {
-    return g_image_buffer;
+    // The frame that will be presented, to draw into directly between CbuiFrameRasterize(true)
+    // and CbuiFramePresent. With the pixel buffer ring that isn't the image buffer, and
+    // outside that window there is no such frame.
+    assert(g_image_frame != NULL && g_damage.direct && "ImageBufferGet: call CbuiFrameRasterize(true) first");
+    return g_image_frame;
 }
 u8 *ImageBufferInit(MArena *a_dest) {
     g_image_buffer = (u8*) ArenaAlloc(a_dest, IMG_BUFF_CHANNELS * IMG_BUFF_MAX_WIDTH * IMG_BUFF_MAX_HEIGHT);
@@ -4419,6 +5954,7 @@ PlafGlfw* PlafGlfwInit(const char *title, u32 window_width = 640, u32 window_hei
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
     plf->window = glfwCreateWindow(plf->width, plf->height, title, NULL, NULL);
     glfwMakeContextCurrent(plf->window);
+    glfwSwapInterval(g_frame_pacer.vsync ? 1 : 0);
 
     // glew
     glewExperimental = GL_TRUE;
@@ -4433,13 +5969,15 @@ PlafGlfw* PlafGlfwInit(const char *title, u32 window_width = 640, u32 window_hei
     glfwSetKeyCallback(plf->window, KeyCallBack);
     glfwSetMouseButtonCallback(plf->window, MouseButtonCallBack);
     glfwSetScrollCallback(plf->window, MouseScrollCallBack);
+    glfwSetCursorPosCallback(plf->window, CursorPosCallBack);
+    glfwSetWindowRefreshCallback(plf->window, WindowRefreshCallBack);
     glfwSetWindowUserPointer(plf->window, plf);
 
     // window resize
     glfwSetFramebufferSizeCallback(g_plaf_glfw.window, WindowResizeCallBack);
 
     // shader
-    plf->image_buffer = ImageBufferGet();
+    plf->image_buffer = g_image_buffer;
     plf->screen = ScreenProgramInit(plf->image_buffer, plf->width, plf->height);
 
     // initialize mouse position values (dx and dy are initialized to zero)
@@ -4454,59 +5992,97 @@ PlafGlfw* PlafGlfwInit(const char *title, u32 window_width = 640, u32 window_hei
     return plf;
 }
 
+void PlafHeadlessTerminate(PlafGlfw* plf);
+
 void PlafGlfwTerminate(PlafGlfw* plf) {
+    if (plf->headless) {
+        PlafHeadlessTerminate(plf);
+        return;
+    }
     glfwDestroyWindow(plf->window);
     glfwTerminate();
 }
 
 void PlafGlfwToggleFullscreen(PlafGlfw* plf) {
+    // borderless window over the whole monitor and back, the window and its GL context stay
     plf->fullscreen = !plf->fullscreen;
     if (plf->fullscreen) {
         assert(plf->width_cache == 0);
         assert(plf->height_cache == 0);
 
-        plf->width_cache = plf->width;
-        plf->height_cache = plf->height;
+        s32 window_w;
+        s32 window_h;
+        glfwGetWindowSize(plf->window, &window_w, &window_h);
         glfwGetWindowPos(plf->window, &plf->window_xpos, &plf->window_ypos);
+        plf->width_cache = window_w;
+        plf->height_cache = window_h;
 
-        GLFWmonitor *monitor = glfwGetWindowMonitor(plf->window);
-
-        const GLFWvidmode *mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
-        plf->width = mode->width;
-        plf->height = mode->height;
+        GLFWmonitor *monitor = glfwGetPrimaryMonitor();
+        const GLFWvidmode *mode = glfwGetVideoMode(monitor);
+        s32 monitor_x;
+        s32 monitor_y;
+        glfwGetMonitorPos(monitor, &monitor_x, &monitor_y);
 
-        glfwSetWindowMonitor(plf->window, monitor, 0, 0, plf->width, plf->height, GLFW_DONT_CARE);
+        glfwSetWindowAttrib(plf->window, GLFW_DECORATED, GLFW_FALSE);
+        glfwSetWindowMonitor(plf->window, NULL, monitor_x, monitor_y, mode->width, mode->height, GLFW_DONT_CARE);
     }
     else {
-        plf->width = plf->width_cache;
-        plf->height = plf->height_cache;
+        glfwSetWindowAttrib(plf->window, GLFW_DECORATED, GLFW_TRUE);
+        glfwSetWindowMonitor(plf->window, NULL, plf->window_xpos, plf->window_ypos, plf->width_cache, plf->height_cache, GLFW_DONT_CARE);
 
         plf->width_cache = 0;
         plf->height_cache = 0;
+    }
 
-        // doesn't get us back into windowed
-        //glfwSetWindowMonitor(plf->window, NULL, 0, 0, 0, 0, GLFW_DONT_CARE);
-        // TODO: try creating a "windowed full screen" mode switch
+    // the size callback may come now or with the next poll, don't wait for it
+    s32 fb_w;
+    s32 fb_h;
+    glfwGetFramebufferSize(plf->window, &fb_w, &fb_h);
+    plf->resize_width = fb_w;
+    plf->resize_height = fb_h;
+    plf->resize_pending = true;
+    PlafGlfwApplyResize(plf);
+}
 
-        // destroy and re-create everything (!?!)
-        glfwDestroyWindow(plf->window);
-        glfwTerminate();
-        plf = PlafGlfwInit(plf->title, plf->width, plf->height);
+u8 *PlafGlfwAcquireFrame(PlafGlfw* plf) {
+    if (plf->headless) {
+        plf->frame = plf->image_buffer;
     }
-
-    plf->screen.SetSize(plf->image_buffer, plf->width, plf->height);
+    else {
+        plf->frame = plf->screen.AcquireFrame(plf->image_buffer, plf->width, plf->height);
+    }
+    g_image_frame = plf->frame;
+    return plf->frame;
 }
 
+void PlafGlfwPollEvents(PlafGlfw* plf, u64 wait_us = 0);
+
 void PlafGlfwUpdate(PlafGlfw* plf) {
+    if (plf->akeys.fkey == 2) {
+        // toggle the damage overlay
+
+        g_damage.show = !g_damage.show;
+    }
+
+    // the damage rects are stale after a size change, the next frame redraws everything
+    u32 rects_cnt = 0;
+    if (g_damage.width == (s32) plf->width && g_damage.height == (s32) plf->height) {
+        rects_cnt = g_damage.rects_cnt;
+    }
+    plf->screen.Draw(plf->frame, plf->width, plf->height, g_damage.rects, rects_cnt);
+    glfwSwapBuffers(plf->window);
+
     if (plf->akeys.fkey == 10) {
         // toggle fullscreen
 
         PlafGlfwToggleFullscreen(plf);
     }
 
-    plf->screen.Draw(plf->image_buffer, plf->width, plf->height);
-    glfwSwapBuffers(plf->window);
+    PlafGlfwPollEvents(plf);
+}
 
+void PlafGlfwPollEvents(PlafGlfw* plf, u64 wait_us) {
+    // starts the next frame's input, waits up to wait_us for an event if there is none yet
     plf->left = {};
     plf->right = {};
     plf->scroll = {};
@@ -4532,7 +6108,218 @@ void PlafGlfwUpdate(PlafGlfw* plf) {
     plf->cursorpos.x_frac = x_frac;
     plf->cursorpos.y_frac = y_frac;
 
-    glfwPollEvents();
+    plf->events = 0;
+    if (wait_us) {
+        glfwWaitEventsTimeout(wait_us / 1000000.0);
+    }
+    else {
+        glfwPollEvents();
+    }
+    PlafGlfwApplyResize(plf);
+}
+
+
+static PlafHeadless g_plaf_headless;
+
+s32 HeadlessKeyCode(const char *name) {
+    if (name[0] >= '0' && name[0] <= '9' && name[1] != '\0') {
+        return atoi(name);
+    }
+    if (name[1] == '\0') {
+        char c = name[0];
+        if (c >= 'a' && c <= 'z') {
+            c = c - 'a' + 'A';
+        }
+        return ((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) ? c : GLFW_KEY_UNKNOWN;
+    }
+    if (!strcmp(name, "left")) { return GLFW_KEY_LEFT; }
+    if (!strcmp(name, "right")) { return GLFW_KEY_RIGHT; }
+    if (!strcmp(name, "up")) { return GLFW_KEY_UP; }
+    if (!strcmp(name, "down")) { return GLFW_KEY_DOWN; }
+    if (!strcmp(name, "space")) { return GLFW_KEY_SPACE; }
+    if (!strcmp(name, "enter")) { return GLFW_KEY_ENTER; }
+    if (!strcmp(name, "esc")) { return GLFW_KEY_ESCAPE; }
+    if ((name[0] == 'f' || name[0] == 'F') && atoi(name + 1) >= 1 && atoi(name + 1) <= 12) {
+        return GLFW_KEY_F1 + atoi(name + 1) - 1;
+    }
+    return GLFW_KEY_UNKNOWN;
+}
+
+bool HeadlessScriptLoad(MArena *a_dest, PlafHeadless *hl, const char *filepath) {
+    FILE *f = fopen(filepath, "r");
+    if (f == NULL) {
+        printf("headless: could not open script %s\n", filepath);
+        return false;
+    }
+    hl->script = (HeadlessKey*) ArenaAlloc(a_dest, sizeof(HeadlessKey) * HEADLESS_SCRIPT_MAX);
+    hl->script_len = 0;
+
+    char line[256];
+    u32 lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        u64 frameno;
+        char action[16];
+        char key[32];
+        if (line[0] == '#' || sscanf(line, "%llu %15s %31s", (unsigned long long*) &frameno, action, key) != 3) {
+            continue;
+        }
+        HeadlessKey hk = {};
+        hk.frameno = frameno;
+        hk.key = HeadlessKeyCode(key);
+        hk.action = !strcmp(action, "press") ? GLFW_PRESS : !strcmp(action, "release") ? GLFW_RELEASE : -1;
+        bool in_order = hl->script_len == 0 || hl->script[hl->script_len - 1].frameno <= frameno;
+        if (hk.key == GLFW_KEY_UNKNOWN || hk.action == -1 || in_order == false) {
+            printf("headless: %s:%u: bad key line, skipped\n", filepath, lineno);
+            continue;
+        }
+        if (hl->script_len == HEADLESS_SCRIPT_MAX) {
+            printf("headless: %s: more than %u keys, the rest are dropped\n", filepath, HEADLESS_SCRIPT_MAX);
+            break;
+        }
+        hl->script[hl->script_len++] = hk;
+    }
+    fclose(f);
+    if (hl->script_len == 0) {
+        printf("headless: no keys in script %s\n", filepath);
+        return false;
+    }
+    return true;
+}
+
+void HeadlessScriptApply(PlafGlfw *plf, PlafHeadless *hl) {
+    // feeds the keys scripted for this frame, stamped as if they came in during the last
+    // one, like keys caught by glfwPollEvents, so this frame's game ticks consume them
+    u64 t_arrival = hl->t_us - hl->dt_us;
+    while (hl->script_at < hl->script_len && hl->script[hl->script_at].frameno <= hl->frames) {
+        HeadlessKey hk = hl->script[hl->script_at++];
+        PlafKeyInput(plf, hk.key, hk.action, 0, t_arrival);
+        if (hk.action == GLFW_PRESS && hk.key >= 'A' && hk.key <= 'Z') {
+            plf->keys.Put(hk.key - 'A' + 'a');
+        }
+        else if (hk.action == GLFW_PRESS && hk.key >= ' ' && hk.key <= '9') {
+            plf->keys.Put(hk.key);
+        }
+    }
+}
+
+void HeadlessDumpFrame(PlafGlfw *plf, PlafHeadless *hl) {
+    Color *src = (Color*) plf->frame;
+    if (hl->dump_raw) {
+        fwrite(src, sizeof(Color), (u64) plf->width * plf->height, hl->dump);
+        return;
+    }
+    fprintf(hl->dump, "P6\n%u %u\n255\n", plf->width, plf->height);
+    for (u32 y = 0; y < plf->height; ++y) {
+        u8 *dest = hl->dump_row;
+        for (u32 x = 0; x < plf->width; ++x) {
+            Color c = *src++;
+            *dest++ = c.r;
+            *dest++ = c.g;
+            *dest++ = c.b;
+        }
+        fwrite(hl->dump_row, 3, plf->width, hl->dump);
+    }
+}
+
+PlafGlfw* PlafHeadlessInit(MArena *a_life, const char *title, u32 width, u32 height, PlafHeadlessCfg cfg) {
+    assert(width <= IMG_BUFF_MAX_WIDTH && height <= IMG_BUFF_MAX_HEIGHT);
+
+    g_plaf_glfw = {};
+    g_plaf_headless = {};
+    PlafGlfw *plf = &g_plaf_glfw;
+    PlafHeadless *hl = &g_plaf_headless;
+    plf->headless = hl;
+    plf->width = width;
+    plf->height = height;
+    plf->title = (char*) title;
+
+    hl->frames_max = cfg.frames_max;
+    hl->dt_us = cfg.dt_us ? cfg.dt_us : HEADLESS_DT_US;
+    hl->t_us = hl->dt_us;
+    if (cfg.script_path && HeadlessScriptLoad(a_life, hl, cfg.script_path) == false) {
+        // a run without its input would measure and dump the wrong thing
+        printf("headless: could not load script %s, exiting ...\n", cfg.script_path);
+        exit(1);
+    }
+    if (cfg.dump_path) {
+        u32 len = strlen(cfg.dump_path);
+        hl->dump_raw = len >= 4 && !strcmp(cfg.dump_path + len - 4, ".raw");
+        hl->dump = fopen(cfg.dump_path, "wb");
+        hl->dump_row = (u8*) ArenaAlloc(a_life, 3 * IMG_BUFF_MAX_WIDTH);
+        if (hl->dump == NULL) {
+            printf("headless: could not open dump %s, exiting ...\n", cfg.dump_path);
+            exit(1);
+        }
+    }
+
+    hl->t_wall_start = ReadMonotonicTimerMySec();
+    hl->t_wall_prev = hl->t_wall_start;
+
+    return plf;
+}
+
+void PlafHeadlessUpdate(PlafGlfw* plf) {
+    PlafHeadless *hl = plf->headless;
+    if (plf->akeys.fkey == 2) {
+        g_damage.show = !g_damage.show;
+    }
+    if (hl->dump) {
+        HeadlessDumpFrame(plf, hl);
+    }
+
+    u64 t_wall = ReadMonotonicTimerMySec();
+    hl->hist.Add(t_wall - hl->t_wall_prev);
+    hl->t_wall_prev = t_wall;
+
+    hl->frames++;
+    hl->t_us += hl->dt_us;
+}
+
+void PlafHeadlessFrameStart(PlafGlfw* plf) {
+    // this frame's input, it stays set until the frame is done so a scripted esc ends
+    // the run after its frame, not before
+    PlafHeadless *hl = plf->headless;
+    plf->left = {};
+    plf->right = {};
+    plf->scroll = {};
+    plf->keys = {};
+    plf->akeys.ResetButKeepMods();
+    plf->events = 0;
+    HeadlessScriptApply(plf, hl);
+}
+
+bool PlafHeadlessDone(PlafGlfw* plf) {
+    PlafHeadless *hl = plf->headless;
+    if (hl->frames_max) {
+        return hl->frames >= hl->frames_max;
+    }
+    if (hl->script_len == 0) {
+        return true;
+    }
+    // a frame has to run after the last scripted one, for its keys to be consumed
+    return hl->script_at >= hl->script_len && hl->frames > hl->script[hl->script_len - 1].frameno;
+}
+
+void PlafHeadlessTerminate(PlafGlfw* plf) {
+    PlafHeadless *hl = plf->headless;
+    if (hl->dump) {
+        fclose(hl->dump);
+        hl->dump = NULL;
+    }
+
+    f64 t_wall = (hl->t_wall_prev - hl->t_wall_start) / 1000.0;
+    printf("headless: %llu frames in %.1f ms, %.1f us/frame mean\n",
+        (unsigned long long) hl->frames, t_wall, hl->frames ? t_wall * 1000 / hl->frames : 0.0);
+    hl->hist.Print("headless");
+}
+
+u64 PlafTimeMySec(PlafGlfw* plf) {
+    // the simulated clock when headless
+    if (plf->headless) {
+        return plf->headless->t_us;
+    }
+    return ReadMonotonicTimerMySec();
 }
 
 
@@ -4574,6 +6361,8 @@ inline bool GetFKey(u32 fval) {
     }
 }
 
+inline KeyEventQueue *GetKeyEvents() { return &g_key_events; }
+
 inline bool GetChar(char c) {
     for (s32 i = 0; i < g_plaf_glfw.keys.keys_cnt; ++i) {
         char key = g_plaf_glfw.keys.keys[i];
@@ -4588,7 +6377,7 @@ inline bool ModCtrl() { return g_plaf_glfw.akeys.mod_ctrl; }
 inline bool ModShift() { return g_plaf_glfw.akeys.mod_shift; }
 inline bool ModAlt() { return g_plaf_glfw.akeys.mod_alt; }
 
-bool GetWindowShouldClose(PlafGlfw *plf) { return glfwWindowShouldClose(plf->window); }
+bool GetWindowShouldClose(PlafGlfw *plf) { return plf->headless ? PlafHeadlessDone(plf) : glfwWindowShouldClose(plf->window); }
 
 
 #endif
@@ -4601,16 +6390,22 @@ bool GetWindowShouldClose(PlafGlfw *plf) { return glfwWindowShouldClose(plf->win
 #define __CBUI_INIT_H__
 
 
+#define FR_RUNNING_AVG_COUNT 8
+
 struct CbuiState {
     MContext *ctx;
     PlafGlfw *plf;
     u64 frameno;
-    u64 dts[8];
+    f32 dts[FR_RUNNING_AVG_COUNT];
     u64 t_framestart;
     u64 t_framestart_prev;
-    f32 dt;
+    u64 dt_us;
+    f32 dt; // [ms]
     f32 fr;
     bool running;
+    bool idle;          // the last frame was skipped by CbuiFrameIdle
+    u64 scene_hash;     // of the last drawn frame
+    u64 frames_idle;
 
     f32 TimeSince(f32 t) {
         return t_framestart - t; 
@@ -4620,20 +6415,29 @@ struct CbuiState {
 static CbuiState _g_cbui_state;
 static CbuiState *cbui;
 
-CbuiState *CbuiInit(const char *title, bool start_in_fullscreen, u32 width, u32 height) {
+CbuiState *CbuiInit(const char *title, bool start_in_fullscreen, u32 width, u32 height, PlafHeadlessCfg *headless = NULL) {
+    // runs without a window when given a headless config
     _g_cbui_state = {};
     cbui = &_g_cbui_state;
     cbui->running = true;
     cbui->ctx = InitBaselayer();
-    cbui->plf = PlafGlfwInit(title, width, height);
+    FramePacerInit(FRAME_PACER_HZ_DEFAULT, false);
+    if (headless) {
+        cbui->plf = PlafHeadlessInit(cbui->ctx->a_life, title, width, height, *headless);
+    }
+    else {
+        cbui->plf = PlafGlfwInit(title, width, height);
+    }
     cbui->plf->image_buffer = ImageBufferInit(cbui->ctx->a_life);
-    cbui->t_framestart = ReadSystemTimerMySec();
+    cbui->t_framestart = PlafTimeMySec(cbui->plf);
     cbui->t_framestart_prev = cbui->t_framestart;
 
     InitImUi(cbui->plf->width, cbui->plf->height, &cbui->frameno);
 
     ImageRGBA render_target = { (s32) cbui->plf->width, (s32) cbui->plf->height, (Color*) cbui->plf->image_buffer };
     QuadBufferInit(cbui->ctx->a_life);
+    TextCacheInit(cbui->ctx->a_life);
+    RasterPoolInit(RasterThreadsDefault());
 
     g_texture_map = InitMap(cbui->ctx->a_life, MAX_RESOURCE_CNT);
     g_resource_map = InitMap(cbui->ctx->a_life, MAX_RESOURCE_CNT);
@@ -4652,7 +6456,7 @@ CbuiState *CbuiInit(const char *title, bool start_in_fullscreen, u32 width, u32
             if (log_verbose) { font->Print(); }
 
             MapPut(&g_resource_map, font->GetKey(), font);
-            MapPut(&g_texture_map, font->GetKey(), &font->texture);
+            TextureRegister(font->GetKey(), &font->texture);
         }
 
         // sprite maps
@@ -4664,7 +6468,7 @@ CbuiState *CbuiInit(const char *title, bool start_in_fullscreen, u32 width, u32
             }
 
             MapPut(&g_resource_map, smap->GetKey(), smap);
-            MapPut(&g_texture_map, smap->GetKey(), &smap->texture);
+            TextureRegister(smap->GetKey(), &smap->texture);
         }
 
         // other
@@ -4675,21 +6479,36 @@ CbuiState *CbuiInit(const char *title, bool start_in_fullscreen, u32 width, u32
         // iter
         res = res->GetInlinedNext();
     }
+    TextCacheInvalidate(); // runs shaped with earlier atlases are stale
     SetFontAndSize(FS_48, g_font_names->GetStr());
 
-    if (start_in_fullscreen) { PlafGlfwToggleFullscreen(cbui->plf); }
+    if (start_in_fullscreen && headless == NULL) { PlafGlfwToggleFullscreen(cbui->plf); }
 
     return cbui;
 }
 
 
-#define FR_RUNNING_AVG_COUNT 4
+void CbuiSetFrameRate(u32 target_hz, bool vsync) {
+    // 0 Hz runs unthrottled, with vsync the swap sets the rate
+    FramePacerInit(target_hz, vsync);
+    if (cbui->plf->headless == NULL) {
+        glfwSwapInterval(vsync ? 1 : 0);
+    }
+}
+
 void CbuiFrameStart() {
     ArenaClear(cbui->ctx->a_tmp);
-    ImageBufferClear(cbui->plf->width, cbui->plf->height);
+    if (cbui->plf->headless) {
+        PlafHeadlessFrameStart(cbui->plf);
+    }
 
-    cbui->t_framestart = ReadSystemTimerMySec();
-    cbui->dt = (cbui->t_framestart - cbui->t_framestart_prev) / 1000; // ms
+    cbui->t_framestart = PlafTimeMySec(cbui->plf);
+    cbui->dt_us = cbui->t_framestart - cbui->t_framestart_prev;
+    cbui->dt = cbui->dt_us / 1000.0f; // ms
+    if (cbui->frameno > 0 && cbui->plf->headless == NULL && cbui->idle == false) {
+        FramePacerMark(cbui->dt_us);
+    }
+    cbui->idle = false;
     cbui->dts[cbui->frameno % FR_RUNNING_AVG_COUNT] = cbui->dt;
 
     f32 sum = 0;
@@ -4701,14 +6520,7 @@ void CbuiFrameStart() {
     cbui->frameno++;
 }
 
-void CbuiFrameEnd() {
-    // TODO: get delta t and framerate under control
-    XSleep(1);
-
-    UI_FrameEnd(cbui->ctx->a_tmp, cbui->plf->width, cbui->plf->height);
-    QuadBufferBlitAndClear(InitImageRGBA(cbui->plf->width, cbui->plf->height, g_image_buffer));
-
-    PlafGlfwUpdate(cbui->plf);
+void CbuiFrameInput() {
     // TODO: clean up these globals
     g_mouse_x = cbui->plf->cursorpos.x;
     g_mouse_y = cbui->plf->cursorpos.y;
@@ -4718,7 +6530,73 @@ void CbuiFrameEnd() {
     cbui->running = cbui->running && !GetEscape() && !GetWindowShouldClose(cbui->plf);
 }
 
+void CbuiFrameRasterize(bool direct = false) {
+    // The quads go into the frame. With direct, the frame can then be drawn into through
+    // ImageBufferGet(): it is redrawn in full, a pixel buffer slot holds older frames
+    // outside the damage and all of it goes up.
+    if (direct) {
+        g_damage.direct = true;
+        DamageInvalidate();
+    }
+    UI_FrameEnd(cbui->ctx->a_tmp, cbui->plf->width, cbui->plf->height);
+    u8 *frame = PlafGlfwAcquireFrame(cbui->plf);
+    QuadBufferBlitAndClear(cbui->ctx->a_tmp, InitImageRGBA(cbui->plf->width, cbui->plf->height, frame));
+    if (g_damage.show) {
+        RenderStatsPrint();
+    }
+}
+
+void CbuiFramePresent() {
+    if (cbui->plf->headless) {
+        PlafHeadlessUpdate(cbui->plf);
+    }
+    else {
+        FramePacerWait();
+        PlafGlfwUpdate(cbui->plf);
+    }
+    g_image_frame = NULL;
+    if (g_damage.direct) {
+        // the pixels drawn directly stay in the texture, the next frame covers them
+        g_damage.direct = false;
+        DamageInvalidate();
+    }
+    CbuiFrameInput();
+}
+
+void CbuiFrameEnd() {
+    CbuiFrameRasterize();
+    CbuiFramePresent();
+}
+
+bool CbuiFrameIdle(u64 scene_hash, u64 wait_us) {
+    // Call between CbuiFrameStart and laying out the frame. When the app's scene hash is
+    // that of the last drawn frame and no input or window event came in, the frame would
+    // come out the same: it is skipped, and this waits up to wait_us for an event instead
+    // of laying out, rasterizing and presenting it. Returns true for a skipped frame, the
+    // caller then goes on to the next one without calling CbuiFrameEnd.
+    PlafGlfw *plf = cbui->plf;
+    bool changed = scene_hash != cbui->scene_hash || plf->events != 0 || g_damage.invalid || g_damage.show;
+    cbui->scene_hash = scene_hash;
+    if (changed || plf->headless) {
+        return false;
+    }
+
+    cbui->idle = true;
+    cbui->frames_idle++;
+    PlafGlfwPollEvents(plf, wait_us);
+    CbuiFrameInput();
+    return true;
+}
+
 void CbuiExit() {
+    if (g_frame_pacer.hist.cnt) {
+        g_frame_pacer.hist.Print("frame times");
+    }
+    FramePacerShutdown();
+    if (cbui->frames_idle) {
+        printf("frames skipped idle: %llu\n", (unsigned long long) cbui->frames_idle);
+    }
+    RasterPoolShutdown();
     PlafGlfwTerminate(cbui->plf);
 }
 
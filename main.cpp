@@ -6,35 +6,82 @@
 
 // game and grid types
 #include "src/testris_types.h"
+#include "src/testris_blocks.h"
 
 // game state
-static Testris testris;
-static Grid grid;
+static GameState game;
+static Block game_falling_prev; // falling block before the last tick, for interpolation
 
 // logics and rendering
 #include "src/testris_lib.h"
+#include "src/testris_replay.h"
 #include "src/render_and_update.h"
 
 
+struct TestrisArgs {
+    bool fullscreen;
+    const char *record_path;
+    u64 seed;
+    u32 fps;                    // 0 runs unthrottled
+    bool vsync;
+    PlafHeadlessCfg *headless;  // NULL opens a window
+};
+
+
+// what the frame shows: the game state and the falling block's interpolation
+u64 SceneHash() {
+    Block prev = game_falling_prev;
+    u64 h = GameHash(&game);
+    return Hash64(h ^ prev.tpe ^ (prev.rot << 8) ^ ((u64) (u32) prev.grid_x << 16) ^ ((u64) (u32) prev.grid_y << 40));
+}
+
+
 // the game loop
-void RunTestris(bool start_in_fullscreen) {
-    cbui = CbuiInit("Testris", start_in_fullscreen, 1000, 500);
+void RunTestris(TestrisArgs args) {
+    cbui = CbuiInit("Testris", args.fullscreen, 1000, 500, args.headless);
+    CbuiSetFrameRate(args.fps, args.vsync);
+
+    GameInit(&game, args.seed);
 
-    FillGridBottomRandomly();
+    // the whole session, restarts included, goes into one replay
+    static ReplayWriter rec;
+    if (args.record_path) {
+        ReplayWriterOpen(&rec, args.record_path, args.seed, 0);
+    }
+
+    GameClock clock = GameClockInit(cbui->t_framestart);
     while (cbui->running) {
         CbuiFrameStart();
 
-        switch (testris.mode) {
+        // key events are applied on the tick their timestamp falls in
+        while (GameClockTickDue(&clock, cbui->t_framestart)) {
+            GameInput input = GameInputDrain(GetKeyEvents(), &clock, clock.t_sim_us + TESTRIS_TICK_US);
+
+            game_falling_prev = game.grid.falling;
+            GameStep(&game, input, TESTRIS_TICK_MS);
+            GameClockTick(&clock);
+            if (rec.f) {
+                ReplayWriterStep(&rec, TESTRIS_TICK_MS, input);
+            }
+        }
+
+        // the title and game over screens stand still until a key comes in, wait for it instead of redrawing
+        if (game.testris.mode != TM_MAIN && CbuiFrameIdle(SceneHash(), TESTRIS_IDLE_WAIT_US)) {
+            continue;
+        }
+        f32 alpha = GameClockAlpha(&clock, cbui->t_framestart);
+
+        switch (game.testris.mode) {
             case TM_TITLE : {
-                DoTitleScreen();
+                DoTitleScreen(alpha);
             } break;
 
             case TM_MAIN : {
-                DoMainScreen();
+                DoMainScreen(alpha);
             } break;
 
             case TM_GAMEOVER : {
-                DoGameOver();
+                DoGameOver(alpha);
             } break;
 
             default: break;
@@ -42,6 +89,7 @@ void RunTestris(bool start_in_fullscreen) {
 
         CbuiFrameEnd();
     }
+    ReplayWriterClose(&rec, &game);
     CbuiExit();
 }
 
@@ -51,8 +99,46 @@ int main (int argc, char **argv) {
     BaselayerAssertVersion(0, 2, 3);
     CbuiAssertVersion(0, 2, 1);
 
-    bool start_in_fullscreen = CLAContainsArg("--fullscreen", argc, argv);
-    RunTestris(start_in_fullscreen);
+    TestrisArgs args = {};
+    args.fullscreen = CLAContainsArg("--fullscreen", argc, argv);
+    if (CLAContainsArg("--record", argc, argv)) {
+        args.record_path = CLAGetArgValue("--record", argc, argv);
+    }
+
+    // frame pacing: [--fps N] [--vsync]
+    args.fps = FRAME_PACER_HZ_DEFAULT;
+    if (CLAContainsArg("--fps", argc, argv)) {
+        char *fps = CLAGetArgValue("--fps", argc, argv);
+        args.fps = fps ? (u32) strtoul(fps, NULL, 10) : args.fps;
+    }
+    args.vsync = CLAContainsArg("--vsync", argc, argv);
+
+    // no window: [--frames N] [--script FILE] [--dump FILE.ppm|FILE.raw]
+    PlafHeadlessCfg headless = {};
+    if (CLAContainsArg("--headless", argc, argv)) {
+        args.headless = &headless;
+        if (CLAContainsArg("--script", argc, argv)) {
+            headless.script_path = CLAGetArgValue("--script", argc, argv);
+        }
+        if (CLAContainsArg("--dump", argc, argv)) {
+            headless.dump_path = CLAGetArgValue("--dump", argc, argv);
+        }
+        if (CLAContainsArg("--frames", argc, argv)) {
+            char *frames = CLAGetArgValue("--frames", argc, argv);
+            headless.frames_max = frames ? strtoull(frames, NULL, 10) : 0;
+        }
+        if (headless.script_path == NULL && headless.frames_max == 0) {
+            headless.frames_max = 600;
+        }
+    }
+
+    // a fixed seed makes scripted headless runs reproducible
+    args.seed = McRandom();
+    if (CLAContainsArg("--seed", argc, argv)) {
+        char *seed = CLAGetArgValue("--seed", argc, argv);
+        args.seed = seed ? strtoull(seed, NULL, 10) : args.seed;
+    }
+    RunTestris(args);
 }
 
 
@@ -62,6 +148,9 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
     BaselayerAssertVersion(0, 2, 3);
     CbuiAssertVersion(0, 2, 1);
 
-    RunTestris(false);
+    TestrisArgs args = {};
+    args.seed = McRandom();
+    args.fps = FRAME_PACER_HZ_DEFAULT;
+    RunTestris(args);
 }
 #endif
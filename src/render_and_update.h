@@ -2,113 +2,114 @@
 #define __RENDER_H__
 
 
-f32 RenderGame() {
-    // render the grid
-    f32 grid_unit_sz = cbui->plf->height / (1.0f * grid.visible_height);
+Color SlotColorToColor(u8 color) {
+    switch (color) {
+        case SC_RED: return COLOR_RED;
+        case SC_GREEN: return COLOR_GREEN;
+        case SC_YELLOW: return COLOR_YELLOW;
+        case SC_YELLOW2: return COLOR_YELLOW2;
+        case SC_BLUE: return COLOR_BLUE;
+        case SC_BLACK: return COLOR_BLACK;
+        case SC_GRAY: return COLOR_GRAY;
+        default: return COLOR_WHITE;
+    }
+}
 
-    UI_LayoutExpandCenter();
-    Widget *w_grid  = WidgetGetCached("testris_grid");
-    TreeBranch(w_grid);
-    w_grid->frame_touched = cbui->frameno;
-    w_grid->features_flg |= WF_ABSREL_POSITION;
-    w_grid->features_flg |= WF_LAYOUT_VERTICAL;
-    w_grid->features_flg |= WF_EXPAND_VERTICAL;
-    w_grid->features_flg |= WF_DRAW_BACKGROUND_AND_BORDER;
-    w_grid->h = cbui->plf->height;
-    w_grid->w = grid_unit_sz * 10;
-    w_grid->x0 = (cbui->plf->width - w_grid->w) / 2.0f;
-    w_grid->col_bckgrnd = COLOR_WHITE;
-
-    for (s32 y = 4; y < grid.height; ++y) {
-        for (s32 x = 0; x < grid.width; ++x) {
-            GridSlot *b = grid.GetSlot(y, x);
-            if (b->solid == true) {
-                Widget *g = WidgetGetNew();
-                TreeSibling(g);
-
-                g->features_flg |= WF_DRAW_BACKGROUND_AND_BORDER;
-                g->features_flg |= WF_ABSREL_POSITION;
-                g->w = grid_unit_sz;
-                g->h = grid_unit_sz;
-                g->x0 = x * grid_unit_sz;
-                g->y0 = (y - 4) * grid_unit_sz;
-                g->col_border = COLOR_WHITE;
-                g->sz_border = 1;
-                g->col_bckgrnd = b->color;
+//
+//  Board
+//
+//  The board goes straight from the grid into the quad buffer, two quads per cell,
+//  with no widgets. It is plotted before UI_FrameEnd emits the widget quads, so the
+//  title and game over panels still end up on top.
+
+
+f32 RenderGame(f32 alpha) {
+    Grid *grid = &game.grid;
+
+    f32 grid_unit_sz = cbui->plf->height / (1.0f * grid->visible_height);
+    f32 grid_w = grid_unit_sz * 10;
+    f32 grid_h = cbui->plf->height;
+    f32 grid_x0 = (cbui->plf->width - grid_w) / 2.0f;
+    f32 grid_y0 = 0;
+
+    // render the grid
+    QuadBufferPush(QuadCookSolid(grid_w, grid_h, grid_x0, grid_y0, COLOR_WHITE));
+    for (s32 y = 4; y < grid->height; ++y) {
+        if (grid->rows[y] == 0) {
+            continue;
+        }
+        for (s32 x = 0; x < grid->width; ++x) {
+            if (grid->IsSolid(y, x)) {
+                PanelPlot(grid_x0 + x * grid_unit_sz, grid_y0 + (y - 4) * grid_unit_sz, grid_unit_sz, grid_unit_sz, 1, COLOR_WHITE, SlotColorToColor(grid->colors[y][x]));
             }
         }
     }
 
-    // render grid framing lines
-    s16 ax = round( w_grid->x0 - 0.3f * grid_unit_sz );
-    s16 ay = round( w_grid->y0 );
-    s16 bx = round( w_grid->x0 - 0.3f * grid_unit_sz );
-    s16 by = round(w_grid->y0 + w_grid->h );
-    RenderLineRGBA(cbui->plf->image_buffer, cbui->plf->width, cbui->plf->height, ax, ay, bx, by, COLOR_GRAY_60);
-    ax = round( w_grid->x0 + w_grid->w + 0.3f * grid_unit_sz );
-    ay = round( w_grid->y0 );
-    bx = round( w_grid->x0 + w_grid->w + 0.3f * grid_unit_sz );
-    by = round( w_grid->y0 + w_grid->h );
-    RenderLineRGBA(cbui->plf->image_buffer, cbui->plf->width, cbui->plf->height, ax, ay, bx, by, COLOR_GRAY_60);
-    
-    
-    // render the falling block
-    for (s32 y = 0; y < 4; ++y) {
-        for (s32 x = 0; x < 4; ++x) {
-
-            bool do_fill = grid.falling.data[y][x];
-            s32 yy = y - 4 + grid.falling.grid_y;
-            s32 xx = x + grid.falling.grid_x;
-            if (do_fill && yy >= 0 && yy < grid.height - 4 && xx >= 0 && x < grid.width) {
-
-                Widget *g = UI_Plain();
-                g->features_flg |= WF_DRAW_BACKGROUND_AND_BORDER;
-                g->features_flg |= WF_ABSREL_POSITION;
-                g->w = grid_unit_sz;
-                g->h = grid_unit_sz;
-                g->x0 = xx * grid_unit_sz;
-                g->y0 = yy * grid_unit_sz;
-                g->col_border = COLOR_WHITE;
-                g->sz_border = 1;
-                g->col_bckgrnd = grid.falling.color;
-
-                UI_Pop();
+    // render grid framing lines, as one pixel wide quads so they are damage tracked
+    f32 frame_l = round( grid_x0 - 0.3f * grid_unit_sz );
+    f32 frame_r = round( grid_x0 + grid_w + 0.3f * grid_unit_sz );
+    QuadBufferPush(QuadCookSolid(1, grid_h, frame_l, grid_y0, COLOR_GRAY_60));
+    QuadBufferPush(QuadCookSolid(1, grid_h, frame_r, grid_y0, COLOR_GRAY_60));
+
+
+    // render the ghost piece where the falling block would land
+    const BlockShape *falling = BlockGetShape(grid->falling);
+    if (grid->falling.tpe != BT_UNINITIALIZED) {
+        s32 landing_y = BlockLandingRow(grid, grid->falling);
+
+        for (s32 i = 0; i < 4; ++i) {
+            s32 yy = falling->cell_row[i] - 4 + landing_y;
+            s32 xx = falling->cell_col[i] + grid->falling.grid_x;
+            if (yy >= 0 && yy < grid->height - 4 && xx >= 0 && xx < grid->width) {
+                PanelPlot(grid_x0 + xx * grid_unit_sz, grid_y0 + yy * grid_unit_sz, grid_unit_sz, grid_unit_sz, 2, SlotColorToColor(grid->falling.color), COLOR_GRAY_80);
             }
         }
     }
 
+    // render the falling block, interpolated between the last two ticks when it moved by one cell
+    Block cur = grid->falling;
+    Block prev = game_falling_prev;
+    f32 falling_x = cur.grid_x;
+    f32 falling_y = cur.grid_y;
+    bool same_block = prev.tpe == cur.tpe && prev.mirror == cur.mirror && prev.rot == cur.rot && prev.color == cur.color;
+    if (same_block && abs(cur.grid_x - prev.grid_x) + abs(cur.grid_y - prev.grid_y) == 1) {
+        falling_x = prev.grid_x + (cur.grid_x - prev.grid_x) * alpha;
+        falling_y = prev.grid_y + (cur.grid_y - prev.grid_y) * alpha;
+    }
+
+    for (s32 i = 0; i < 4; ++i) {
+        if (grid->falling.tpe == BT_UNINITIALIZED) {
+            break;
+        }
+        s32 y = falling->cell_row[i];
+        s32 x = falling->cell_col[i];
+        s32 yy = y - 4 + grid->falling.grid_y;
+        s32 xx = x + grid->falling.grid_x;
+        if (yy >= 0 && yy < grid->height - 4 && xx >= 0 && xx < grid->width) {
+            PanelPlot(grid_x0 + (x + falling_x) * grid_unit_sz, grid_y0 + (y - 4 + falling_y) * grid_unit_sz, grid_unit_sz, grid_unit_sz, 1, COLOR_WHITE, SlotColorToColor(grid->falling.color));
+        }
+    }
+
     // render the next block
     s32 offset_x = - 5 * grid_unit_sz;
     s32 offset_y = grid_unit_sz;
-    for (s32 y = 0; y < 4; ++y) {
-        for (s32 x = 0; x < 4; ++x) {
-
-            bool do_fill = grid.next.data[y][x];
-            if (do_fill) {
-
-                Widget *g = UI_Plain();
-                g->features_flg |= WF_DRAW_BACKGROUND_AND_BORDER;
-                g->features_flg |= WF_ABSREL_POSITION;
-                g->w = grid_unit_sz;
-                g->h = grid_unit_sz;
-                g->x0 = x * grid_unit_sz + offset_x;
-                g->y0 = y * grid_unit_sz + offset_y;
-                g->col_border = COLOR_WHITE;
-                g->sz_border = 1;
-                g->col_bckgrnd = grid.next.color;
-
-                UI_Pop();
-            }
+    const BlockShape *next = BlockGetShape(grid->next);
+    for (s32 i = 0; i < 4; ++i) {
+        if (grid->next.tpe == BT_UNINITIALIZED) {
+            break;
         }
+        s32 y = next->cell_row[i];
+        s32 x = next->cell_col[i];
+        PanelPlot(grid_x0 + (x * grid_unit_sz + offset_x), grid_y0 + (y * grid_unit_sz + offset_y), grid_unit_sz, grid_unit_sz, 1, COLOR_WHITE, SlotColorToColor(grid->next.color));
     }
 
-    return w_grid->w + 0.6f * grid_unit_sz;
+    return grid_w + 0.6f * grid_unit_sz;
 }
 
-void DoGameOver() {
-    f32 grid_visual_width = RenderGame();
+void DoGameOver(f32 alpha) {
+    f32 grid_visual_width = RenderGame(alpha);
 
-    UI_Pop();
+    UI_LayoutExpandCenter();
     Widget *w = WidgetGetCached("game_over_panel");
     w->frame_touched = cbui->frameno;
     w->features_flg |= WF_DRAW_BACKGROUND_AND_BORDER;
@@ -123,26 +124,13 @@ void DoGameOver() {
     TreeBranch(w);
 
     SetFontSize(FS_36);
-    Widget *q = UI_Label("GAME OVER");
-
-
-    if (GetSpace()) {
-        if (TimeSinceModeStart_ms() > 300.0f) {
-            ClearGridTopAndMiddle();
-            FillGridBottomRandomly();
-
-            grid.falling = BlockCreate();
-            grid.next = BlockCreate();
-
-            testris.SetMode(TM_MAIN, cbui->t_framestart);
-        }
-    }
+    UI_Label("GAME OVER");
 }
 
-void DoTitleScreen() {
-    f32 grid_visual_width = RenderGame();
+void DoTitleScreen(f32 alpha) {
+    f32 grid_visual_width = RenderGame(alpha);
 
-    UI_Pop();
+    UI_LayoutExpandCenter();
     Widget *w = WidgetGetCached("game_over_panel");
     w->features_flg |= WF_DRAW_BACKGROUND_AND_BORDER;
     w->features_flg |= WF_LAYOUT_VERTICAL;
@@ -161,76 +149,49 @@ void DoTitleScreen() {
     UI_Label("TESTRIS");
     SetFontSize(FS_18);
     UI_Label("[l/r/u/d space]");
-
-    if (GetSpace()) {
-        grid.falling = BlockCreate();
-        grid.next = BlockCreate();
-
-        testris.SetMode(TM_MAIN, cbui->t_framestart);
-    }
 }
 
-void UpdateTime() {
-    testris.t_fall += cbui->dt;
-    if (testris.t_fall >= TESTRIS_FALL_INTERVAL) {
-        testris.t_fall = 0;
-    }
+void DoMainScreen(f32 alpha) {
+    RenderGame(alpha);
 }
 
-void DoMainScreen() {
-    UpdateTime();
-    UpdateGridState();
-
-    // controls
-    if (GetChar('w') || GetUp()) {
-        BlockRotateIfAble();
-    }
-    else if (GetChar('a') || GetLeft()) {
-        testris.t_lr_down = 0;
-
-        BlockLeftIfAble();
-    }
-    else if (GetChar('d') || GetRight()) {
-        testris.t_lr_down = 0;
-
-        BlockRightIfAble();
-    }
-    else if (GetChar('s') || GetDown()) {
-        testris.t_lr_down = 0;
-
-        BlockFallOrFreeze();
-    }
-    else if (GetSpace()) {
-        while (BlockFallOrFreeze());
+u8 GameKeysFromGlfwKey(s32 key) {
+    switch (key) {
+        case GLFW_KEY_W: case GLFW_KEY_UP: return GK_ROTATE;
+        case GLFW_KEY_A: case GLFW_KEY_LEFT: return GK_LEFT;
+        case GLFW_KEY_D: case GLFW_KEY_RIGHT: return GK_RIGHT;
+        case GLFW_KEY_S: case GLFW_KEY_DOWN: return GK_DOWN;
+        case GLFW_KEY_SPACE: return GK_DROP | GK_START;
+        default: return 0;
     }
-    // auto-fall
-    else if (testris.t_fall == 0) {
-        BlockFallOrFreeze();
-    }
-
-    // hold left/right
-    if (testris.t_lr_down > TESTRIS_HOLDKEY_INTERVAL) {
-        if (testris_a_state || testris_l_state) { 
-            testris.t_lr_down = 0;
+}
 
-            BlockLeftIfAble();
+GameInput GameInputDrain(KeyEventQueue *events, GameClock *clock, u64 t_until_us) {
+    // consumes the key events up to t_until_us, at most one per game key so no press is lost
+    GameInput input = {};
+    u8 touched = 0;
+
+    KeyEvent e;
+    while (events->Peek(&e) && e.t_us < t_until_us) {
+        u8 keys = GameKeysFromGlfwKey(e.key);
+        if (keys & touched) {
+            // same key again, leave it for the next tick
+            break;
         }
-        else if (testris_d_state || testris_r_state) {
-            testris.t_lr_down = 0;
+        events->Pop();
+        touched |= keys;
 
-            BlockRightIfAble();
+        if (e.action == GLFW_PRESS) {
+            input.pressed |= keys;
+            clock->held |= keys;
         }
-        else if (testris_s_state || testris_adown_state) {
-            testris.t_lr_down = 0;
-
-            BlockFallOrFreeze();
+        else {
+            clock->held &= ~keys;
         }
     }
-    testris.t_lr_down += cbui->dt;
+    input.held = clock->held;
 
-    // render
-    RenderGame();
+    return input;
 }
 
-
 #endif
@@ -0,0 +1,256 @@
+#ifndef __TESTRIS_BLOCKS_H__
+#define __TESTRIS_BLOCKS_H__
+
+
+//
+//  Block shape tables
+//
+//  Every (BlockType, mirror, rotation) state is generated at compile time, so a
+//  block is just an index into g_block_shapes: rotating increments Block::rot and
+//  spawning picks an entry. Mirroring flips the first three columns and rotation
+//  turns the 4x4 box for BT_LONG, the top-left 3x3 box otherwise, and leaves BT_BOX
+//  alone - the same transforms the game has always applied.
+//
+//  col_bottom is the lowest occupied row per column, and lets the landing row be
+//  read off the grid's column heights instead of stepping the block down.
+
+
+struct BlockShape {
+    u8 rows[4];     // row masks, bit col is set for an occupied cell
+    s8 cell_row[4]; // the four occupied cells
+    s8 cell_col[4];
+    s8 col_bottom[4]; // lowest occupied row per column, -1 if the column is empty
+};
+
+struct BlockShapeTable {
+    BlockShape shapes[BT_CNT][2][4]; // [tpe][mirror][rot]
+};
+
+constexpr BlockShape BlockShapeFromCells(const s8 *cell_row, const s8 *cell_col) {
+    BlockShape shape = {};
+    for (s32 col = 0; col < 4; ++col) {
+        shape.col_bottom[col] = -1;
+    }
+    for (s32 i = 0; i < 4; ++i) {
+        shape.cell_row[i] = cell_row[i];
+        shape.cell_col[i] = cell_col[i];
+        shape.rows[cell_row[i]] |= (u8) (1 << cell_col[i]);
+        if (cell_row[i] > shape.col_bottom[cell_col[i]]) {
+            shape.col_bottom[cell_col[i]] = cell_row[i];
+        }
+    }
+    return shape;
+}
+
+constexpr BlockShapeTable BlockShapeTableBuild() {
+    // spawn shapes, as row/col cell coordinates
+    const s8 spawn_rows[BT_CNT][4] = {
+        {},
+        { 0, 1, 2, 3 }, // BT_LONG
+        { 0, 0, 1, 1 }, // BT_STEP
+        { 0, 1, 1, 1 }, // BT_TEE
+        { 0, 0, 1, 1 }, // BT_BOX
+        { 0, 1, 2, 2 }, // BT_ELL
+    };
+    const s8 spawn_cols[BT_CNT][4] = {
+        {},
+        { 1, 1, 1, 1 },
+        { 0, 1, 1, 2 },
+        { 1, 0, 1, 2 },
+        { 0, 1, 0, 1 },
+        { 0, 0, 0, 1 },
+    };
+
+    BlockShapeTable table = {};
+    for (s32 tpe = BT_LONG; tpe < BT_CNT; ++tpe) {
+        for (s32 mirror = 0; mirror < 2; ++mirror) {
+            s8 cell_row[4] = {};
+            s8 cell_col[4] = {};
+            for (s32 i = 0; i < 4; ++i) {
+                cell_row[i] = spawn_rows[tpe][i];
+                cell_col[i] = spawn_cols[tpe][i];
+                if (mirror && cell_col[i] < 3) {
+                    cell_col[i] = 2 - cell_col[i];
+                }
+            }
+
+            for (s32 rot = 0; rot < 4; ++rot) {
+                table.shapes[tpe][mirror][rot] = BlockShapeFromCells(cell_row, cell_col);
+
+                // rotate clockwise for the next entry
+                for (s32 i = 0; i < 4; ++i) {
+                    s8 row = cell_row[i];
+                    s8 col = cell_col[i];
+                    if (tpe == BT_LONG) {
+                        cell_row[i] = col;
+                        cell_col[i] = 3 - row;
+                    }
+                    else if (tpe != BT_BOX) {
+                        cell_row[i] = col;
+                        cell_col[i] = 2 - row;
+                    }
+                }
+            }
+        }
+    }
+
+    return table;
+}
+
+static constexpr BlockShapeTable g_block_shapes = BlockShapeTableBuild();
+
+inline
+const BlockShape *BlockGetShape(Block b) {
+    return &g_block_shapes.shapes[b.tpe][b.mirror][b.rot];
+}
+
+
+//
+//  Table check
+//
+//  The per-cell BlockRotate / BlockMirrorX shuffles that the tables replace,
+//  kept verbatim as a reference. The tables are checked against them at compile time.
+
+
+struct BlockCells {
+    bool data[4][4];
+};
+
+constexpr BlockCells BlockCellsSpawnReference(BlockType tpe) {
+    BlockCells block = {};
+    switch (tpe) {
+        case BT_LONG: {
+            block.data[0][1] = true;
+            block.data[1][1] = true;
+            block.data[2][1] = true;
+            block.data[3][1] = true;
+        } break;
+        case BT_STEP: {
+            block.data[0][0] = true;
+            block.data[0][1] = true;
+            block.data[1][1] = true;
+            block.data[1][2] = true;
+        } break;
+        case BT_TEE: {
+            block.data[0][1] = true;
+            block.data[1][0] = true;
+            block.data[1][1] = true;
+            block.data[1][2] = true;
+        } break;
+        case BT_BOX: {
+            block.data[0][0] = true;
+            block.data[0][1] = true;
+            block.data[1][0] = true;
+            block.data[1][1] = true;
+        } break;
+        case BT_ELL: {
+            block.data[0][0] = true;
+            block.data[1][0] = true;
+            block.data[2][0] = true;
+            block.data[2][1] = true;
+        } break;
+        default: break;
+    }
+    return block;
+}
+
+constexpr BlockCells BlockRotateReference(BlockType tpe, BlockCells b) {
+    BlockCells r = b;
+
+    if (tpe == BT_LONG) {
+        r.data[0][0] = b.data[3][0];
+        r.data[0][1] = b.data[2][0];
+        r.data[0][2] = b.data[1][0];
+        r.data[0][3] = b.data[0][0];
+
+        r.data[1][0] = b.data[3][1];
+        r.data[1][1] = b.data[2][1];
+        r.data[1][2] = b.data[1][1];
+        r.data[1][3] = b.data[0][1];
+
+        r.data[2][0] = b.data[3][2];
+        r.data[2][1] = b.data[2][2];
+        r.data[2][2] = b.data[1][2];
+        r.data[2][3] = b.data[0][2];
+
+        r.data[3][0] = b.data[3][3];
+        r.data[3][1] = b.data[2][3];
+        r.data[3][2] = b.data[1][3];
+        r.data[3][3] = b.data[0][3];
+    }
+    else if (tpe == BT_BOX) {
+        // we don't need to rotate it
+    }
+    else {
+        r.data[0][0] = b.data[2][0];
+        r.data[0][1] = b.data[1][0];
+        r.data[0][2] = b.data[0][0];
+
+        r.data[1][0] = b.data[2][1];
+        r.data[1][1] = b.data[1][1];
+        r.data[1][2] = b.data[0][1];
+
+        r.data[2][0] = b.data[2][2];
+        r.data[2][1] = b.data[1][2];
+        r.data[2][2] = b.data[0][2];
+
+        r.data[3][0] = b.data[2][3];
+        r.data[3][1] = b.data[1][3];
+        r.data[3][2] = b.data[0][3];
+    }
+
+    return r;
+}
+
+constexpr BlockCells BlockMirrorXReference(BlockCells b) {
+    BlockCells m = b;
+    for (s32 y = 0; y < 4; ++y) {
+        m.data[y][0] = b.data[y][2];
+        m.data[y][2] = b.data[y][0];
+    }
+    return m;
+}
+
+constexpr bool BlockShapeTableCheck() {
+    for (s32 tpe = BT_LONG; tpe < BT_CNT; ++tpe) {
+        for (s32 mirror = 0; mirror < 2; ++mirror) {
+            BlockCells cells = BlockCellsSpawnReference((BlockType) tpe);
+            if (mirror) {
+                cells = BlockMirrorXReference(cells);
+            }
+
+            for (s32 rot = 0; rot < 4; ++rot) {
+                BlockShape shape = g_block_shapes.shapes[tpe][mirror][rot];
+
+                s32 cnt = 0;
+                for (s32 col = 0; col < 4; ++col) {
+                    s32 bottom = -1;
+                    for (s32 row = 0; row < 4; ++row) {
+                        bool occupied = (shape.rows[row] >> col) & 1;
+                        if (occupied != cells.data[row][col]) {
+                            return false;
+                        }
+                        if (occupied) {
+                            bottom = row;
+                        }
+                        cnt += occupied;
+                    }
+                    if (bottom != shape.col_bottom[col]) {
+                        return false;
+                    }
+                }
+                if (cnt != 4) {
+                    return false;
+                }
+
+                cells = BlockRotateReference((BlockType) tpe, cells);
+            }
+        }
+    }
+    return true;
+}
+
+static_assert(BlockShapeTableCheck(), "block shape tables disagree with BlockRotate / BlockMirrorX");
+
+
+#endif
@@ -4,335 +4,473 @@
 
 #define TESTRIS_FALL_INTERVAL 400
 #define TESTRIS_ANIMATE_INTERVAL 100
-#define TESTRIS_HOLDKEY_INTERVAL 70
+#define TESTRIS_HOLDKEY_INTERVAL 70   // auto-repeat and soft drop interval
+#define TESTRIS_DAS_DELAY 170         // hold time before left/right auto-repeat
+#define TESTRIS_RESTART_DELAY 300
 
+#define TESTRIS_TICK_MS 5                           // fixed simulation step
+#define TESTRIS_TICK_US (TESTRIS_TICK_MS * 1000)
+#define TESTRIS_MAX_FRAME_US 250000                 // longer frames are not caught up on
+#define TESTRIS_IDLE_WAIT_US 500000                 // longest wait for input on a still screen
 
-f32 TimeSinceModeStart_ms() {
-    f32 t_delta_ms = (cbui->t_framestart - testris.t_mode_start) / 1000;
+
+f32 TimeSinceModeStart_ms(GameState *gs) {
+    f32 t_delta_ms = gs->t - gs->testris.t_mode_start;
     return t_delta_ms;
 }
 
-void UpdateGridState() {
+void UpdateGridState(GameState *gs, f32 dt) {
+    Grid *grid = &gs->grid;
+
     // find the blinking row, or eliminate a blinking row that has timed out
-    for (s32 row = 0; row < grid.height; ++row) {
+    for (s32 row = 0; row < grid->height; ++row) {
+        f32 blinking = grid->blinking[row];
+        if (blinking == 0) {
+            continue;
+        }
+
+        if (blinking > (TESTRIS_ANIMATE_INTERVAL * 3)) {
+            // eliminate this row
+            grid->EliminateRow(row);
+            grid->pause_falling = false;
+            gs->lines++;
 
-        for (s32 col = 0; col < grid.width; ++col) {
-            GridSlot *b = grid.GetSlot(row, col);
+            return;
+        }
 
-            if (b->blinking > (TESTRIS_ANIMATE_INTERVAL * 3)) {
+        u8 color;
+        if (blinking > TESTRIS_ANIMATE_INTERVAL * 2) {
+            color = SC_BLACK;
+        }
+        else if (blinking > TESTRIS_ANIMATE_INTERVAL) {
+            color = SC_GRAY;
+        }
+        else {
+            color = SC_BLACK;
+        }
+        memset(grid->colors[row], color, grid->width);
 
-                // eliminate this row
-                for (s32 z = row - 1; z >= 0; --z) {
-                    for (s32 x = 0; x < grid.width; ++x) {
+        grid->blinking[row] += dt;
+    }
+}
 
-                        grid.data[z + 1][x] = grid.data[z][x];
-                        grid.data[z][x] = {};
-                    }
-                }
-                grid.pause_falling = false;
+void MarkFullRows(Grid *grid, s32 row_first, s32 row_last) {
+    // start the blinking sequence on full rows in [row_first, row_last]
+    row_first = MaxS32(row_first, 0);
+    row_last = MinS32(row_last, grid->height - 1);
 
-                return;
-            }
-            else if (b->blinking > 0 && (b->blinking > TESTRIS_ANIMATE_INTERVAL * 2)) {
-                b->color = COLOR_BLACK;
-            }
-            else if (b->blinking > 0 && (b->blinking > TESTRIS_ANIMATE_INTERVAL)) {
-                b->color = COLOR_GRAY;
-            }
-            else if (b->blinking > 0) {
-                b->color = COLOR_BLACK;
-            }
+    for (s32 row = row_first; row <= row_last; ++row) {
+        if (grid->RowIsFull(row)) {
+            grid->pause_falling = true;
 
-            if (b->blinking > 0) {
-                b->blinking += cbui->dt;
+            if (grid->blinking[row] == 0) {
+                grid->blinking[row] = 1;
             }
         }
     }
 }
 
-bool BlockCollides(Block block) {
-    for (s32 row = 0; row < 4; ++row) {
-        for (s32 col = 0; col < 4; ++col) {
-
-            if (block.data[row][col]) {
-                s32 y = row + block.grid_y;
-                s32 x = col + block.grid_x;
+bool BlockCollides(Grid *grid, Block block) {
+    s32 shift = block.grid_x + GRID_WALL_BITS;
+    if (shift < 0) {
+        return true;
+    }
 
-                bool in_range = y >= 0 && y < grid.height && x >= 0 && col < grid.width;
-                bool collides = !in_range || grid.GetSlot(y, x)->solid;
+    const BlockShape *shape = BlockGetShape(block);
+    for (s32 row = 0; row < 4; ++row) {
+        u32 mask = shape->rows[row];
+        if (mask == 0) {
+            continue;
+        }
 
-                if (collides) {
-                    return true;
-                }
-            }
+        s32 y = row + block.grid_y;
+        if (y < 0 || y >= grid->height) {
+            return true;
+        }
+        if ((mask << shift) & (grid->rows[y] | GRID_ROW_WALLS)) {
+            return true;
         }
     }
 
     return false;
 }
 
-Block BlockRotate(Block b) {
-    Block r = b;
-
-    if (b.tpe == BT_LONG) {
-        r.data[0][0] = b.data[3][0];
-        r.data[0][1] = b.data[2][0];
-        r.data[0][2] = b.data[1][0];
-        r.data[0][3] = b.data[0][0];
-
-        r.data[1][0] = b.data[3][1];
-        r.data[1][1] = b.data[2][1];
-        r.data[1][2] = b.data[1][1];
-        r.data[1][3] = b.data[0][1];
-
-        r.data[2][0] = b.data[3][2];
-        r.data[2][1] = b.data[2][2];
-        r.data[2][2] = b.data[1][2];
-        r.data[2][3] = b.data[0][2];
-
-        r.data[3][0] = b.data[3][3];
-        r.data[3][1] = b.data[2][3];
-        r.data[3][2] = b.data[1][3];
-        r.data[3][3] = b.data[0][3];
-    }
-    else if (b.tpe == BT_BOX) {
-        // we don't need to rotate it
+s32 BlockLandingRowStepped(Grid *grid, Block block) {
+    Block test = block;
+    test.grid_y += 1;
+    while (BlockCollides(grid, test) == false) {
+        test.grid_y += 1;
     }
-    else {
-        r.data[0][0] = b.data[2][0];
-        r.data[0][1] = b.data[1][0];
-        r.data[0][2] = b.data[0][0];
+    return test.grid_y - 1;
+}
 
-        r.data[1][0] = b.data[2][1];
-        r.data[1][1] = b.data[1][1];
-        r.data[1][2] = b.data[0][1];
+s32 BlockLandingRow(Grid *grid, Block block) {
+    // the grid_y at which the block would come to rest if dropped straight down
+    const BlockShape *shape = BlockGetShape(block);
 
-        r.data[2][0] = b.data[2][2];
-        r.data[2][1] = b.data[1][2];
-        r.data[2][2] = b.data[0][2];
+    s32 landing = grid->height;
+    for (s32 c = 0; c < 4; ++c) {
+        s32 bottom = shape->col_bottom[c];
+        if (bottom < 0) {
+            continue;
+        }
 
-        r.data[3][0] = b.data[2][3];
-        r.data[3][1] = b.data[1][3];
-        r.data[3][2] = b.data[0][3];
+        s32 col = block.grid_x + c;
+        assert(col >= 0 && col < grid->width);
+        s32 top = grid->height - grid->col_heights[col];
+        if (block.grid_y + bottom >= top) {
+            // tucked in under an overhang, where the skyline says nothing
+            return BlockLandingRowStepped(grid, block);
+        }
+        landing = MinS32(landing, top - 1 - bottom);
     }
 
-    return r;
+    return landing;
 }
 
-Block BlockMirrorX(Block b) {
-    // NOTE: Only mirror the first 3 columns: Otherwise the blocks spawn at inconsistent column position
+Block BlockRotate(Block b) {
+    Block r = b;
+    r.rot = (b.rot + 1) & 3;
 
-    Block m = b;
-    for (s32 y = 0; y < 4; ++y) {
-        m.data[y][0] = b.data[y][2];
-        m.data[y][2] = b.data[y][0];
-    }
-    return m;
+    return r;
 }
 
-void BlockRotateIfAble() {
-    Block rot = BlockRotate(grid.falling);
-    if (BlockCollides(rot) == false) {
-        grid.falling = rot;
+void BlockRotateIfAble(Grid *grid) {
+    Block rot = BlockRotate(grid->falling);
+    if (BlockCollides(grid, rot) == false) {
+        grid->falling = rot;
     }
 }
 
-void BlockLeftIfAble() {
-    Block left = grid.falling;
+void BlockLeftIfAble(Grid *grid) {
+    Block left = grid->falling;
     left.grid_x -= 1;
-    if (BlockCollides(left) == false) {
-        grid.falling = left;
+    if (BlockCollides(grid, left) == false) {
+        grid->falling = left;
     }
 }
 
-void BlockRightIfAble() {
-    Block right = grid.falling;
+void BlockRightIfAble(Grid *grid) {
+    Block right = grid->falling;
     right.grid_x += 1;
-    if (BlockCollides(right) == false) {
-        grid.falling = right;
+    if (BlockCollides(grid, right) == false) {
+        grid->falling = right;
     }
 }
 
-Block BlockCreate() {
+Block BlockCreate(GameState *gs) {
 
-    s32 color_selector = RandMinMaxI(0, 3);
-    Color blocks_color;
+    s32 color_selector = gs->rng.MinMax(0, 3);
+    u8 blocks_color;
     switch (color_selector) {
-        case 0: blocks_color = COLOR_RED; break;
-        case 1: blocks_color = COLOR_GREEN; break;
-        case 2: blocks_color = COLOR_YELLOW2; break;
-        case 3: blocks_color = COLOR_BLUE; break;
+        case 0: blocks_color = SC_RED; break;
+        case 1: blocks_color = SC_GREEN; break;
+        case 2: blocks_color = SC_YELLOW2; break;
+        case 3: blocks_color = SC_BLUE; break;
         default: assert(1 == 0 && "switch default"); break;
     }
 
     Block block = {};
-    block.tpe = (BlockType) RandMinMaxI(1, 5);
+    block.tpe = (BlockType) gs->rng.MinMax(1, 5);
     block.grid_y = 1;
     block.grid_x = 3;
     block.color = blocks_color;
 
-    switch (block.tpe) {
-        case BT_LONG: {
-            block.data[0][1] = true;
-            block.data[1][1] = true;
-            block.data[2][1] = true;
-            block.data[3][1] = true;
-        } break;
-        case BT_STEP: {
-            block.data[0][0] = true;
-            block.data[0][1] = true;
-            block.data[1][1] = true;
-            block.data[1][2] = true;
-        } break;
-        case BT_TEE: {
-            block.data[0][1] = true;
-            block.data[1][0] = true;
-            block.data[1][1] = true;
-            block.data[1][2] = true;
-        } break;
-        case BT_BOX: {
-            block.data[0][0] = true;
-            block.data[0][1] = true;
-            block.data[1][0] = true;
-            block.data[1][1] = true;
-        } break;
-        case BT_ELL: {
-            block.data[0][0] = true;
-            block.data[1][0] = true;
-            block.data[2][0] = true;
-            block.data[2][1] = true;
-        } break;
-        default: assert(1 == 0 && "switch default"); break;
-    }
-
-    // randomly mirror
-    if (RandMinMaxI(0, 1) == 1) {
-        block = BlockMirrorX(block);
-    }
-
-    // randomly rotate
-    s32 rotations = RandMinMaxI(0, 3);
-    for (s32 i = 0; i < rotations; ++i) {
-        block = BlockRotate(block);
-    }
+    // randomly mirror and rotate
+    block.mirror = (u8) gs->rng.MinMax(0, 1);
+    block.rot = (u8) gs->rng.MinMax(0, 3);
 
     return block;
 }
 
-bool BlockFallOrFreeze() {
-    Block test = grid.falling;
+bool BlockFallOrFreeze(GameState *gs) {
+    Grid *grid = &gs->grid;
+
+    Block test = grid->falling;
     test.grid_y += 1;
-    bool can_fall = ! BlockCollides(test);
+    bool can_fall = ! BlockCollides(grid, test);
 
     if (can_fall) {
-        grid.falling.grid_y += 1;
+        grid->falling.grid_y += 1;
     }
 
     else {
-        GridSlot slot = {};
-        slot.color = grid.falling.color;
-        slot.solid = true;
-
         // solidify into the grid
-        for (s32 row = 0; row < 4; ++row) {
-            for (s32 col = 0; col < 4; ++col) {
-                if (grid.falling.data[row][col]) {
-                    s32 y = row + grid.falling.grid_y;
-                    s32 x = col + grid.falling.grid_x;
-
-                    grid.SetSlot(y, x, slot);
-                }
-            }
+        const BlockShape *shape = BlockGetShape(grid->falling);
+        for (s32 i = 0; i < 4; ++i) {
+            s32 y = shape->cell_row[i] + grid->falling.grid_y;
+            s32 x = shape->cell_col[i] + grid->falling.grid_x;
+
+            grid->SetSlot(y, x, grid->falling.color);
         }
+        gs->pieces++;
+
+        // only rows this piece landed in can have become full
+        MarkFullRows(grid, grid->falling.grid_y, grid->falling.grid_y + 3);
 
-        if (grid.falling.grid_y < 4) {
-            testris.SetMode(TM_GAMEOVER, cbui->t_framestart);
+        if (grid->falling.grid_y < 4) {
+            gs->testris.SetMode(TM_GAMEOVER, gs->t);
         }
 
         // spawn
-        if (grid.next.tpe == BT_UNINITIALIZED) {
-            grid.falling = BlockCreate();
+        if (grid->next.tpe == BT_UNINITIALIZED) {
+            grid->falling = BlockCreate(gs);
         }
         else {
-            grid.falling = grid.next;
+            grid->falling = grid->next;
         }
 
-        grid.falling = grid.next;
-        grid.next = BlockCreate();
+        grid->falling = grid->next;
+        grid->next = BlockCreate(gs);
     }
 
-    // find full rows
-    for (s32 row = grid.height - 1; row >= 0; --row) {
-        bool row_full = true;
-        for (s32 col = 0; col < grid.width; ++col) {
-            row_full = row_full && grid.GetSlot(row, col)->solid;
-        }
+    return can_fall;
+}
+
+void FillGridRandomly(GameState *gs) {
+    Grid *grid = &gs->grid;
 
-        if (row_full) {
-            grid.pause_falling = true;
+    for (s32 row = 0; row < grid->height; ++row) {
+        for (s32 col = 0; col < grid->width; ++col) {
 
-            for (s32 col = 0; col < grid.width; ++col) {
-                GridSlot *b = grid.GetSlot(row, col);
+            u8 color;
+            s32 color_selector = gs->rng.MinMax(0, 3);
+            switch (color_selector) {
+                case 0: color = SC_RED; break;
+                case 1: color = SC_GREEN; break;
+                case 2: color = SC_YELLOW; break;
+                case 3: color = SC_BLUE; break;
+                default: assert(1 == 0 && "switch default"); break;
+            }
 
-                // start blinking sequence
-                if (b->blinking == 0) {
-                    b->blinking = 1;
-                }
+            if (gs->rng.MinMax(0, 1) == 1) {
+                grid->SetSlot(row, col, color);
+            }
+            else {
+                grid->ClearSlot(row, col);
             }
         }
     }
-
-    return can_fall;
+    MarkFullRows(grid, 0, grid->height - 1);
 }
 
-void FillGridRandomly() {
-    for (s32 row = 0; row < grid.height; ++row) {
-        for (s32 col = 0; col < grid.width; ++col) {
+void FillGridBottomRandomly(GameState *gs) {
+    Grid *grid = &gs->grid;
 
-            GridSlot *block = grid.GetSlot(row, col);
+    for (s32 row = grid->visible_height; row < grid->height; ++row) {
+        for (s32 col = 0; col < grid->width; ++col) {
 
-            s32 color_selector = RandMinMaxI(0, 3);
+            u8 color;
+            s32 color_selector = gs->rng.MinMax(0, 3);
             switch (color_selector) {
-                case 0: block->color = COLOR_RED; break;
-                case 1: block->color = COLOR_GREEN; break;
-                case 2: block->color = COLOR_YELLOW; break;
-                case 3: block->color = COLOR_BLUE; break;
+                case 0: color = SC_RED; break;
+                case 1: color = SC_GREEN; break;
+                case 2: color = SC_YELLOW2; break;
+                case 3: color = SC_BLUE; break;
                 default: assert(1 == 0 && "switch default"); break;
             }
 
-            block->solid = RandMinMaxI(0, 1) == 1;
+            if (gs->rng.MinMax(0, 1) == 1) {
+                grid->SetSlot(row, col, color);
+            }
+            else {
+                grid->ClearSlot(row, col);
+            }
         }
     }
+    MarkFullRows(grid, grid->visible_height, grid->height - 1);
 }
 
-void FillGridBottomRandomly() {
-    for (s32 row = grid.visible_height; row < grid.height; ++row) {
-        for (s32 col = 0; col < grid.width; ++col) {
+void ClearGridTopAndMiddle(Grid *grid) {
+    for (s32 row = 0; row < grid->visible_height; ++row) {
+        grid->ClearRow(row);
+    }
+}
 
-            GridSlot *block = grid.GetSlot(row, col);
 
-            s32 color_selector = RandMinMaxI(0, 3);
-            switch (color_selector) {
-                case 0: block->color = COLOR_RED; break;
-                case 1: block->color = COLOR_GREEN; break;
-                case 2: block->color = COLOR_YELLOW2; break;
-                case 3: block->color = COLOR_BLUE; break;
-                default: assert(1 == 0 && "switch default"); break;
+//
+//  Game API
+
+
+void GameInit(GameState *gs, u64 seed, u64 stream = 0) {
+    *gs = {};
+    gs->rng.Seed(seed, stream);
+
+    FillGridBottomRandomly(gs);
+}
+
+void GameStart(GameState *gs) {
+    Grid *grid = &gs->grid;
+
+    grid->falling = BlockCreate(gs);
+    grid->next = BlockCreate(gs);
+
+    gs->testris.SetMode(TM_MAIN, gs->t);
+}
+
+void GameStepMain(GameState *gs, GameInput input, f32 dt) {
+    Testris *testris = &gs->testris;
+    Grid *grid = &gs->grid;
+
+    // gravity timer, keeping the overshoot
+    testris->t_fall += dt;
+    bool fall_due = false;
+    if (testris->t_fall >= TESTRIS_FALL_INTERVAL) {
+        testris->t_fall -= TESTRIS_FALL_INTERVAL;
+        fall_due = true;
+    }
+    UpdateGridState(gs, dt);
+
+    // presses, every one of them, in a fixed order
+    if (input.pressed & GK_ROTATE) {
+        BlockRotateIfAble(grid);
+    }
+    if (input.pressed & GK_LEFT) {
+        testris->das_key = GK_LEFT;
+        testris->t_das = TESTRIS_DAS_DELAY;
+
+        BlockLeftIfAble(grid);
+    }
+    if (input.pressed & GK_RIGHT) {
+        testris->das_key = GK_RIGHT;
+        testris->t_das = TESTRIS_DAS_DELAY;
+
+        BlockRightIfAble(grid);
+    }
+    if (input.pressed & GK_DOWN) {
+        testris->t_softdrop = TESTRIS_HOLDKEY_INTERVAL;
+
+        BlockFallOrFreeze(gs);
+    }
+    if (input.pressed & GK_DROP) {
+        grid->falling.grid_y = BlockLandingRow(grid, grid->falling);
+        BlockFallOrFreeze(gs);
+    }
+
+    // delayed auto-shift: a held left/right repeats after TESTRIS_DAS_DELAY, then every TESTRIS_HOLDKEY_INTERVAL
+    if ((input.held & testris->das_key) == 0) {
+        // released, hand over to the other direction if that one is still down
+        u8 held_lr = input.held & (GK_LEFT | GK_RIGHT);
+        testris->das_key = 0;
+        if (held_lr == GK_LEFT || held_lr == GK_RIGHT) {
+            testris->das_key = held_lr;
+            testris->t_das = TESTRIS_DAS_DELAY;
+        }
+    }
+    else if ((input.pressed & testris->das_key) == 0) {
+        testris->t_das -= dt;
+        while (testris->t_das <= 0) {
+            testris->t_das += TESTRIS_HOLDKEY_INTERVAL;
+
+            if (testris->das_key == GK_LEFT) {
+                BlockLeftIfAble(grid);
             }
+            else {
+                BlockRightIfAble(grid);
+            }
+        }
+    }
+
+    // soft drop
+    if ((input.held & GK_DOWN) && (input.pressed & GK_DOWN) == 0) {
+        testris->t_softdrop -= dt;
+        while (testris->t_softdrop <= 0) {
+            testris->t_softdrop += TESTRIS_HOLDKEY_INTERVAL;
 
-            block->solid = RandMinMaxI(0, 1) == 1;
+            BlockFallOrFreeze(gs);
         }
     }
+
+    // auto-fall
+    if (fall_due) {
+        BlockFallOrFreeze(gs);
+    }
+}
+
+void GameStep(GameState *gs, GameInput input, f32 dt) {
+    gs->t += dt;
+
+    switch (gs->testris.mode) {
+        case TM_TITLE : {
+            if (input.pressed & GK_START) {
+                GameStart(gs);
+            }
+        } break;
+
+        case TM_MAIN : {
+            GameStepMain(gs, input, dt);
+        } break;
+
+        case TM_GAMEOVER : {
+            if ((input.pressed & GK_START) && TimeSinceModeStart_ms(gs) > TESTRIS_RESTART_DELAY) {
+                ClearGridTopAndMiddle(&gs->grid);
+                FillGridBottomRandomly(gs);
+                GameStart(gs);
+            }
+        } break;
+
+        default: break;
+    }
 }
 
-void ClearGridTopAndMiddle() {
-    for (s32 row = 0; row < grid.visible_height; ++row) {
-        for (s32 col = 0; col < grid.width; ++col) {
 
-            GridSlot *block = grid.GetSlot(row, col);
-            *block = {};
+//
+//  Fixed timestep
+//
+//  The game runs in TESTRIS_TICK_MS steps that track real time: each frame runs
+//  the ticks that fit before now, so game speed does not depend on the frame rate,
+//  and tick n covers real time [t_sim_us, t_sim_us + TESTRIS_TICK_US).
+
+
+GameClock GameClockInit(u64 t_now_us) {
+    GameClock clock = {};
+    clock.t_sim_us = t_now_us;
+    return clock;
+}
+
+bool GameClockTickDue(GameClock *clock, u64 t_now_us) {
+    // longer gaps than TESTRIS_MAX_FRAME_US are skipped, not caught up on
+    if (t_now_us > clock->t_sim_us + TESTRIS_MAX_FRAME_US) {
+        clock->t_sim_us = t_now_us - TESTRIS_MAX_FRAME_US;
+    }
+    return clock->t_sim_us + TESTRIS_TICK_US <= t_now_us;
+}
+
+void GameClockTick(GameClock *clock) {
+    clock->t_sim_us += TESTRIS_TICK_US;
+}
+
+f32 GameClockAlpha(GameClock *clock, u64 t_now_us) {
+    // how far real time is into the next tick, in [0, 1)
+    return (t_now_us - clock->t_sim_us) / (f32) TESTRIS_TICK_US;
+}
+
+u64 GridHash(Grid *grid) {
+    u64 h = 0;
+    for (s32 row = 0; row < grid->height; ++row) {
+        h = Hash64(h ^ grid->rows[row]) + row;
+    }
+    return h;
+}
+
+u64 GameHash(GameState *gs) {
+    // final-state fingerprint: board cells and colors, blocks in play, counters
+    Grid *grid = &gs->grid;
+
+    u64 h = GridHash(grid);
+    for (s32 row = 0; row < grid->height; ++row) {
+        for (s32 col = 0; col < grid->width; ++col) {
+            h = Hash64(h ^ grid->colors[row][col]);
         }
     }
+    Block blocks[2] = { grid->falling, grid->next };
+    for (s32 i = 0; i < 2; ++i) {
+        Block b = blocks[i];
+        h = Hash64(h ^ b.tpe ^ (b.color << 4) ^ (b.mirror << 12) ^ (b.rot << 16) ^ ((u64) (u32) b.grid_x << 24) ^ ((u64) (u32) b.grid_y << 40));
+    }
+    h = Hash64(h ^ gs->testris.mode ^ ((u64) gs->pieces << 8) ^ ((u64) gs->lines << 40));
+
+    return h;
 }
 
 
@@ -0,0 +1,304 @@
+#ifndef __TESTRIS_REPLAY_H__
+#define __TESTRIS_REPLAY_H__
+
+
+//
+//  Replays
+//
+//  A game is fully determined by its seed and the (dt, input) of every GameStep,
+//  so that is all a replay stores. Layout, all integers LEB128 varints:
+//
+//      header:  'T' 'R' 'P' 'L', u8 version, seed, stream
+//      records: (run << 1 | has_input), zigzag(dt - dt_prev), [u8 pressed, u8 held]
+//      end:     a single 0
+//      footer:  steps, pieces, lines, u8 mode, u64 GameHash (little endian)
+//
+//  A record covers `run` consecutive steps with the same dt and input, so idle
+//  frames at a steady frame rate collapse to a couple of bytes. The timestamp of
+//  a step is the sum of the dts before it.
+
+
+#define REPLAY_VERSION 1
+#define REPLAY_WRITE_BUFFER (16 * 1024)
+#define REPLAY_STEPS_MAX 100000000ull // a day at 1000 steps a second, a corrupt run past it is rejected
+
+
+struct ReplayInfo {
+    u64 seed;
+    u64 stream;
+    u64 steps;
+    u32 pieces;
+    u32 lines;
+    TestrisMode mode;
+    u64 hash;
+};
+
+struct ReplayWriter {
+    FILE *f;
+    u32 used;
+    u8 buf[REPLAY_WRITE_BUFFER];
+
+    // pending run
+    u32 run;
+    u32 dt;
+    GameInput input;
+    u32 dt_prev;
+    u64 steps;
+};
+
+
+//
+//  Varints
+
+
+u64 ZigZag(s64 v) {
+    return ((u64) v << 1) ^ (u64) (v >> 63);
+}
+
+s64 UnZigZag(u64 v) {
+    return (s64) (v >> 1) ^ -(s64) (v & 1);
+}
+
+bool ReplayGetVarint(u8 **at, u8 *end, u64 *val) {
+    u64 v = 0;
+    for (s32 shift = 0; shift < 64; shift += 7) {
+        if (*at >= end) {
+            return false;
+        }
+        u8 byte = *(*at)++;
+        v |= (u64) (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            *val = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ReplayGetU8(u8 **at, u8 *end, u8 *val) {
+    if (*at >= end) {
+        return false;
+    }
+    *val = *(*at)++;
+    return true;
+}
+
+
+//
+//  Writer
+
+
+void ReplayFlush(ReplayWriter *w) {
+    if (w->used) {
+        fwrite(w->buf, 1, w->used, w->f);
+        w->used = 0;
+    }
+}
+
+void ReplayPutU8(ReplayWriter *w, u8 byte) {
+    if (w->used == REPLAY_WRITE_BUFFER) {
+        ReplayFlush(w);
+    }
+    w->buf[w->used++] = byte;
+}
+
+void ReplayPutVarint(ReplayWriter *w, u64 val) {
+    while (val >= 0x80) {
+        ReplayPutU8(w, (u8) (val | 0x80));
+        val >>= 7;
+    }
+    ReplayPutU8(w, (u8) val);
+}
+
+void ReplayPutRun(ReplayWriter *w) {
+    if (w->run == 0) {
+        return;
+    }
+
+    bool has_input = w->input.pressed || w->input.held;
+    ReplayPutVarint(w, ((u64) w->run << 1) | has_input);
+    ReplayPutVarint(w, ZigZag((s64) w->dt - w->dt_prev));
+    if (has_input) {
+        ReplayPutU8(w, w->input.pressed);
+        ReplayPutU8(w, w->input.held);
+    }
+
+    w->dt_prev = w->dt;
+    w->run = 0;
+}
+
+bool ReplayWriterOpen(ReplayWriter *w, const char *filepath, u64 seed, u64 stream) {
+    FILE *f = fopen(filepath, "wb");
+    if (f == NULL) {
+        printf("ReplayWriterOpen: Could not open file %s\n", filepath);
+        return false;
+    }
+
+    w->f = f;
+    w->used = 0;
+    w->run = 0;
+    w->dt = 0;
+    w->input = {};
+    w->dt_prev = 0;
+    w->steps = 0;
+
+    ReplayPutU8(w, 'T');
+    ReplayPutU8(w, 'R');
+    ReplayPutU8(w, 'P');
+    ReplayPutU8(w, 'L');
+    ReplayPutU8(w, REPLAY_VERSION);
+    ReplayPutVarint(w, seed);
+    ReplayPutVarint(w, stream);
+
+    return true;
+}
+
+void ReplayWriterStep(ReplayWriter *w, u32 dt, GameInput input) {
+    // call after every GameStep with the same dt and input
+    bool same = (w->run > 0 && dt == w->dt && input.pressed == w->input.pressed && input.held == w->input.held);
+    if (same == false) {
+        ReplayPutRun(w);
+        w->dt = dt;
+        w->input = input;
+    }
+    w->run++;
+    w->steps++;
+}
+
+void ReplayWriterClose(ReplayWriter *w, GameState *gs) {
+    if (w->f == NULL) {
+        return;
+    }
+
+    ReplayPutRun(w);
+    ReplayPutVarint(w, 0);
+
+    ReplayPutVarint(w, w->steps);
+    ReplayPutVarint(w, gs->pieces);
+    ReplayPutVarint(w, gs->lines);
+    ReplayPutU8(w, (u8) gs->testris.mode);
+    u64 hash = GameHash(gs);
+    for (s32 i = 0; i < 8; ++i) {
+        ReplayPutU8(w, (u8) (hash >> (i * 8)));
+    }
+
+    ReplayFlush(w);
+    fclose(w->f);
+    w->f = NULL;
+}
+
+
+//
+//  Player
+
+
+bool ReplayPlay(u8 *data, u64 size, GameState *gs, ReplayInfo *recorded) {
+    // re-simulates the replay into gs, returns false if it is malformed
+    u8 *at = data;
+    u8 *end = data + size;
+
+    u8 magic[5];
+    for (s32 i = 0; i < 5; ++i) {
+        if (ReplayGetU8(&at, end, magic + i) == false) {
+            return false;
+        }
+    }
+    if (magic[0] != 'T' || magic[1] != 'R' || magic[2] != 'P' || magic[3] != 'L' || magic[4] != REPLAY_VERSION) {
+        return false;
+    }
+
+    *recorded = {};
+    if (!ReplayGetVarint(&at, end, &recorded->seed) || !ReplayGetVarint(&at, end, &recorded->stream)) {
+        return false;
+    }
+    GameInit(gs, recorded->seed, recorded->stream);
+
+    u64 steps = 0;
+    u32 dt = 0;
+    while (true) {
+        u64 head;
+        if (ReplayGetVarint(&at, end, &head) == false) {
+            return false;
+        }
+        if (head == 0) {
+            break;
+        }
+
+        u64 dt_delta;
+        if (ReplayGetVarint(&at, end, &dt_delta) == false) {
+            return false;
+        }
+        dt = (u32) ((s64) dt + UnZigZag(dt_delta));
+
+        GameInput input = {};
+        if (head & 1) {
+            if (!ReplayGetU8(&at, end, &input.pressed) || !ReplayGetU8(&at, end, &input.held)) {
+                return false;
+            }
+        }
+
+        // the run is read as is, check it before stepping it
+        if ((head >> 1) > REPLAY_STEPS_MAX - steps) {
+            return false;
+        }
+        for (u64 run = head >> 1; run > 0; --run) {
+            GameStep(gs, input, (f32) dt);
+        }
+        steps += head >> 1;
+    }
+
+    u64 pieces, lines;
+    u8 mode;
+    if (!ReplayGetVarint(&at, end, &recorded->steps) || !ReplayGetVarint(&at, end, &pieces) || !ReplayGetVarint(&at, end, &lines) || !ReplayGetU8(&at, end, &mode)) {
+        return false;
+    }
+    recorded->pieces = (u32) pieces;
+    recorded->lines = (u32) lines;
+    recorded->mode = (TestrisMode) mode;
+    for (s32 i = 0; i < 8; ++i) {
+        u8 byte;
+        if (ReplayGetU8(&at, end, &byte) == false) {
+            return false;
+        }
+        recorded->hash |= (u64) byte << (i * 8);
+    }
+
+    return steps == recorded->steps;
+}
+
+bool ReplayVerify(u8 *data, u64 size, GameState *gs, ReplayInfo *recorded) {
+    // plays the replay and checks that it ends on the recorded board
+    if (ReplayPlay(data, size, gs, recorded) == false) {
+        return false;
+    }
+    bool match =
+        gs->pieces == recorded->pieces &&
+        gs->lines == recorded->lines &&
+        gs->testris.mode == recorded->mode &&
+        GameHash(gs) == recorded->hash;
+
+    return match;
+}
+
+u8 *ReplayLoad(const char *filepath, u64 *size, u8 **buffer, u64 *capacity) {
+    // reads the file into a reusable, growing buffer
+    FILE *f = fopen(filepath, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    u64 len = (u64) ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (len > *capacity) {
+        *capacity = MaxU64(len, 2 * *capacity);
+        *buffer = (u8*) realloc(*buffer, *capacity);
+    }
+
+    *size = fread(*buffer, 1, len, f);
+    fclose(f);
+    return *buffer;
+}
+
+
+#endif
@@ -14,47 +14,95 @@ enum BlockType {
     BT_CNT
 };
 
+enum SlotColor {
+    SC_NONE,
+
+    SC_RED,
+    SC_GREEN,
+    SC_YELLOW,
+    SC_YELLOW2,
+    SC_BLUE,
+    SC_BLACK,
+    SC_GRAY,
+
+    SC_CNT
+};
+
 struct Block {
     BlockType tpe;
-    Color color;
-
-    bool data[4][4]; // 4x4 indices 0..3 x 0..3
+    u8 color;
+    u8 mirror;  // index into g_block_shapes
+    u8 rot;     // index into g_block_shapes
     s32 grid_y;
     s32 grid_x;
 };
 
-struct GridSlot {
-    Color color;
-    bool solid;
-    f32 blinking;
-};
-GridSlot block_zero;
+
+//
+//  Occupancy bitboard
+//
+//  Each grid row is a single u32, with bit (GRID_WALL_BITS + col) set for a solid
+//  cell. The padding bits around the ten playfield columns are treated as walls, so
+//  a block row mask shifted by (grid_x + GRID_WALL_BITS) collides iff it has a bit in
+//  common with (row | GRID_ROW_WALLS). A row is full iff it equals GRID_ROW_CELLS.
+//  Colors and the line-clear animation are kept in separate planes.
+
+
+#define GRID_WIDTH 10
+#define GRID_HEIGHT 24
+#define GRID_WALL_BITS 4
+#define GRID_ROW_CELLS (((1u << GRID_WIDTH) - 1) << GRID_WALL_BITS)
+#define GRID_ROW_WALLS (~GRID_ROW_CELLS)
+
 
 struct Grid {
-    s32 width = 10;
-    s32 height = 24;
+    s32 width = GRID_WIDTH;
+    s32 height = GRID_HEIGHT;
     s32 visible_height = 20;
-    GridSlot data[24][10];
+    u32 rows[GRID_HEIGHT];
+    u8 colors[GRID_HEIGHT][GRID_WIDTH];
+    f32 blinking[GRID_HEIGHT];
+    u8 col_heights[GRID_WIDTH]; // skyline: height - row of the highest solid cell, 0 if empty
 
     Block falling;
     Block next;
     bool pause_falling;
 
-    GridSlot *GetSlot(s32 row, s32 col) {
+    bool IsSolid(s32 row, s32 col) {
         if (row >= 0 && row < height && col >= 0 && col < width) {
-            return &data[row][col];
+            return (rows[row] >> (GRID_WALL_BITS + col)) & 1;
         }
         else {
-            block_zero = {};
-            block_zero.solid = true;
+            return true;
+        }
+    }
 
-            return &block_zero;
+    void UpdateColumnHeight(s32 col) {
+        u32 bit = 1u << (GRID_WALL_BITS + col);
+        s32 row = 0;
+        while (row < height && (rows[row] & bit) == 0) {
+            ++row;
         }
+        col_heights[col] = (u8) (height - row);
     }
 
-    void SetSlot(s32 row, s32 col, GridSlot b) {
+    void UpdateColumnHeights() {
+        for (s32 col = 0; col < width; ++col) {
+            UpdateColumnHeight(col);
+        }
+    }
+
+    bool RowIsFull(s32 row) {
+        return rows[row] == GRID_ROW_CELLS;
+    }
+
+    void SetSlot(s32 row, s32 col, u8 color) {
         if (row >= 0 && row < height && col >= 0 && col < width) {
-            data[row][col] = b;
+            rows[row] |= 1u << (GRID_WALL_BITS + col);
+            colors[row][col] = color;
+            if (height - row > col_heights[col]) {
+                col_heights[col] = (u8) (height - row);
+            }
         }
         else {
             assert(1 == 0 && "SetBlock: out of scope");
@@ -63,12 +111,31 @@ struct Grid {
 
     void ClearSlot(s32 row, s32 col) {
         if (row >= 0 && row < height && col >= 0 && col < width) {
-            data[row][col] = {};
+            rows[row] &= ~(1u << (GRID_WALL_BITS + col));
+            colors[row][col] = SC_NONE;
+            if (height - row == col_heights[col]) {
+                UpdateColumnHeight(col);
+            }
         }
         else {
             assert(1 == 0 && "ClearBlock: out of scope");
         }
     }
+
+    void ClearRow(s32 row) {
+        rows[row] = 0;
+        blinking[row] = 0;
+        memset(colors[row], SC_NONE, GRID_WIDTH);
+        UpdateColumnHeights();
+    }
+
+    void EliminateRow(s32 row) {
+        // shift everything above the row down by one
+        memmove(rows + 1, rows, row * sizeof(rows[0]));
+        memmove(colors + 1, colors, row * sizeof(colors[0]));
+        memmove(blinking + 1, blinking, row * sizeof(blinking[0]));
+        ClearRow(0);
+    }
 };
 
 enum TestrisMode {
@@ -84,7 +151,9 @@ struct Testris {
     TestrisMode mode_prev;
     f32 t_fall;
     f32 t_mode_start;
-    f32 t_lr_down;
+    u8 das_key;     // GK_LEFT or GK_RIGHT while one is auto-shifting
+    f32 t_das;      // time to the next auto-shift
+    f32 t_softdrop; // time to the next soft drop step
 
     void SetMode(TestrisMode mode_new, f32 t_start) {
         t_mode_start = t_start;
@@ -94,4 +163,95 @@ struct Testris {
 };
 
 
+//
+//  Random
+//
+//  PCG32 (permuted congruential generator): 16 bytes of state, cheap to copy.
+//  Each stream selector gives an independent sequence for the same seed, so
+//  parallel games can be seeded as (seed, game index) without sharing anything.
+//  Bounded draws use Lemire's multiply-and-reject and have no modulo bias.
+
+
+struct Rng {
+    u64 state;
+    u64 inc; // stream selector, always odd
+
+    void Seed(u64 seed, u64 stream = 0) {
+        state = 0;
+        inc = (stream << 1) | 1;
+        Next();
+        state += seed;
+        Next();
+    }
+
+    u32 Next() {
+        u64 old = state;
+        state = old * 6364136223846793005ULL + inc;
+        u32 xorshifted = (u32) (((old >> 18) ^ old) >> 27);
+        u32 rot = (u32) (old >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+    }
+
+    u32 Bounded(u32 bound) {
+        // uniform in [0, bound)
+        assert(bound > 0);
+
+        u64 m = (u64) Next() * bound;
+        u32 low = (u32) m;
+        if (low < bound) {
+            u32 threshold = (0u - bound) % bound;
+            while (low < threshold) {
+                m = (u64) Next() * bound;
+                low = (u32) m;
+            }
+        }
+        return (u32) (m >> 32);
+    }
+
+    s32 MinMax(s32 min, s32 max) {
+        // uniform in [min, max]
+        assert(max > min);
+        return min + (s32) Bounded((u32) (max - min) + 1);
+    }
+};
+
+
+//
+//  Headless game state
+//
+//  Everything a game needs to run lives in GameState, which is stepped by
+//  GameStep() in testris_lib.h. No window, font or image buffer is involved,
+//  so any number of independent games can be stepped in one process.
+
+
+enum GameKey {
+    GK_LEFT = 1 << 0,
+    GK_RIGHT = 1 << 1,
+    GK_DOWN = 1 << 2,
+    GK_ROTATE = 1 << 3,
+    GK_DROP = 1 << 4,
+    GK_START = 1 << 5,
+};
+
+struct GameInput {
+    u8 pressed; // GameKey flags for keys pushed since the previous step
+    u8 held;    // GameKey flags for keys currently down
+};
+
+struct GameClock {
+    u64 t_sim_us; // real time the game has been simulated up to
+    u8 held;      // GameKey flags down as of the last tick
+};
+
+struct GameState {
+    Testris testris;
+    Grid grid;
+    Rng rng;
+    f32 t;      // game clock [ms]
+
+    u32 pieces;
+    u32 lines;
+};
+
+
 #endif
@@ -0,0 +1,310 @@
+#include <thread>
+#include <atomic>
+
+#include "lib/jg_baselayer.h"
+
+// game types and logics, no window needed
+#include "src/testris_types.h"
+#include "src/testris_blocks.h"
+#include "src/testris_lib.h"
+#include "src/testris_replay.h"
+
+
+//
+//  Batch simulator
+//
+//  Runs N seeded games to game over, unthrottled, on a pool of worker threads.
+//  Each worker owns a contiguous range of game indices and pops games from its
+//  front; idle workers steal from the back of other workers' ranges.
+
+
+#define BATCH_DT 16                 // simulated frame time [ms]
+#define BATCH_MAX_STEPS 10000000    // safety cap per game
+
+
+enum BatchBot {
+    BB_NONE,    // no input, blocks just fall
+    BB_RANDOM,  // random moves, rotations and drops
+
+    BB_CNT
+};
+
+struct BatchConfig {
+    u32 ngames;
+    u32 nthreads;
+    u64 seed;
+    BatchBot bot;
+    const char *record_dir; // write a replay per game when set
+};
+
+struct BatchStats {
+    u64 games;
+    u64 steps;
+    u64 pieces;
+    u64 lines;
+    u32 pieces_min;
+    u32 pieces_max;
+    u32 lines_min;
+    u32 lines_max;
+    u64 checksum; // order-independent sum of final board hashes
+
+    void Add(BatchStats other) {
+        if (other.games == 0) {
+            return;
+        }
+        if (games == 0) {
+            *this = other;
+            return;
+        }
+        games += other.games;
+        steps += other.steps;
+        pieces += other.pieces;
+        lines += other.lines;
+        pieces_min = MinU32(pieces_min, other.pieces_min);
+        pieces_max = MaxU32(pieces_max, other.pieces_max);
+        lines_min = MinU32(lines_min, other.lines_min);
+        lines_max = MaxU32(lines_max, other.lines_max);
+        checksum += other.checksum;
+    }
+};
+
+struct alignas(64) BatchWorker {
+    std::atomic<u64> range; // [head, tail) of game indices, packed as tail << 32 | head
+    BatchStats stats;
+};
+
+
+//
+//  Work ranges
+
+
+u64 RangePack(u32 head, u32 tail) {
+    return ((u64) tail << 32) | head;
+}
+
+bool RangePopFront(std::atomic<u64> *range, u32 *idx) {
+    u64 val = range->load(std::memory_order_relaxed);
+    while (true) {
+        u32 head = (u32) val;
+        u32 tail = (u32) (val >> 32);
+        if (head >= tail) {
+            return false;
+        }
+        if (range->compare_exchange_weak(val, RangePack(head + 1, tail))) {
+            *idx = head;
+            return true;
+        }
+    }
+}
+
+bool RangePopBack(std::atomic<u64> *range, u32 *idx) {
+    u64 val = range->load(std::memory_order_relaxed);
+    while (true) {
+        u32 head = (u32) val;
+        u32 tail = (u32) (val >> 32);
+        if (head >= tail) {
+            return false;
+        }
+        if (range->compare_exchange_weak(val, RangePack(head, tail - 1))) {
+            *idx = tail - 1;
+            return true;
+        }
+    }
+}
+
+
+//
+//  Simulation
+
+
+GameInput BatchBotInput(BatchBot bot, Rng *bot_rng) {
+    GameInput input = {};
+    if (bot == BB_RANDOM) {
+        switch (bot_rng->Bounded(16)) {
+            case 0: input.pressed = GK_ROTATE; break;
+            case 1: input.pressed = GK_LEFT; break;
+            case 2: input.pressed = GK_RIGHT; break;
+            case 3: input.pressed = GK_DOWN; break;
+            case 4: input.pressed = GK_DROP; break;
+            default: break;
+        }
+    }
+    return input;
+}
+
+void BatchRunGame(BatchConfig *cfg, u32 game_idx, GameState *gs, BatchStats *stats, ReplayWriter *rec) {
+    // one stream per game: reproducible for a given (seed, game_idx), whatever thread runs it
+    GameInit(gs, cfg->seed, game_idx);
+
+    Rng bot_rng;
+    bot_rng.Seed(~cfg->seed, game_idx);
+
+    if (rec) {
+        char filepath[1024];
+        snprintf(filepath, sizeof(filepath), "%s/game_%08u.trpl", cfg->record_dir, game_idx);
+        if (ReplayWriterOpen(rec, filepath, cfg->seed, game_idx) == false) {
+            rec = NULL;
+        }
+    }
+
+    GameInput input = {};
+    input.pressed = GK_START;
+    u64 steps = 0;
+    do {
+        GameStep(gs, input, BATCH_DT);
+        if (rec) {
+            ReplayWriterStep(rec, BATCH_DT, input);
+        }
+        steps++;
+
+        input = BatchBotInput(cfg->bot, &bot_rng);
+    }
+    while (gs->testris.mode == TM_MAIN && steps < BATCH_MAX_STEPS);
+
+    if (rec) {
+        ReplayWriterClose(rec, gs);
+    }
+
+    BatchStats game = {};
+    game.games = 1;
+    game.steps = steps;
+    game.pieces = gs->pieces;
+    game.lines = gs->lines;
+    game.pieces_min = gs->pieces;
+    game.pieces_max = gs->pieces;
+    game.lines_min = gs->lines;
+    game.lines_max = gs->lines;
+    game.checksum = GridHash(&gs->grid);
+    stats->Add(game);
+}
+
+void BatchWorkerRun(BatchConfig *cfg, BatchWorker *workers, u32 worker_idx) {
+    BatchWorker *self = workers + worker_idx;
+    GameState gs;
+    u32 game_idx;
+    ReplayWriter *rec = NULL;
+    if (cfg->record_dir) {
+        rec = new ReplayWriter;
+    }
+
+    // own range first
+    while (RangePopFront(&self->range, &game_idx)) {
+        BatchRunGame(cfg, game_idx, &gs, &self->stats, rec);
+    }
+
+    // then steal, until every range is drained
+    bool stolen = true;
+    while (stolen) {
+        stolen = false;
+        for (u32 i = 1; i < cfg->nthreads; ++i) {
+            BatchWorker *victim = workers + (worker_idx + i) % cfg->nthreads;
+            if (RangePopBack(&victim->range, &game_idx)) {
+                BatchRunGame(cfg, game_idx, &gs, &self->stats, rec);
+                stolen = true;
+                break;
+            }
+        }
+    }
+
+    delete rec;
+}
+
+BatchStats BatchRun(BatchConfig *cfg) {
+    BatchWorker *workers = new BatchWorker[cfg->nthreads];
+    for (u32 i = 0; i < cfg->nthreads; ++i) {
+        u32 head = (u32) ((u64) cfg->ngames * i / cfg->nthreads);
+        u32 tail = (u32) ((u64) cfg->ngames * (i + 1) / cfg->nthreads);
+        workers[i].range = RangePack(head, tail);
+        workers[i].stats = {};
+    }
+
+    std::thread *threads = new std::thread[cfg->nthreads];
+    for (u32 i = 0; i < cfg->nthreads; ++i) {
+        threads[i] = std::thread(BatchWorkerRun, cfg, workers, i);
+    }
+
+    BatchStats total = {};
+    for (u32 i = 0; i < cfg->nthreads; ++i) {
+        threads[i].join();
+        total.Add(workers[i].stats);
+    }
+
+    delete[] threads;
+    delete[] workers;
+    return total;
+}
+
+
+//
+//  Main
+
+
+u64 BatchArgU64(const char *key, u64 default_value, int argc, char **argv) {
+    if (CLAContainsArg(key, argc, argv) == false) {
+        return default_value;
+    }
+    char *val = CLAGetArgValue(key, argc, argv);
+    if (val == NULL) {
+        return default_value;
+    }
+    return strtoull(val, NULL, 10);
+}
+
+void BatchPrintUsage() {
+    printf("usage: testris_batch [--games N] [--threads N] [--seed N] [--bot none|random] [--record DIR]\n");
+}
+
+int main (int argc, char **argv) {
+    BaselayerAssertVersion(0, 2, 3);
+
+    if (CLAContainsArg("--help", argc, argv)) {
+        BatchPrintUsage();
+        return 0;
+    }
+
+    BatchConfig cfg = {};
+    cfg.ngames = (u32) BatchArgU64("--games", 10000, argc, argv);
+    cfg.nthreads = (u32) BatchArgU64("--threads", std::thread::hardware_concurrency(), argc, argv);
+    cfg.seed = BatchArgU64("--seed", 1, argc, argv);
+    cfg.bot = BB_RANDOM;
+    if (CLAContainsArg("--bot", argc, argv)) {
+        char *bot = CLAGetArgValue("--bot", argc, argv);
+        if (bot && !strcmp(bot, "none")) {
+            cfg.bot = BB_NONE;
+        }
+        else if (bot == NULL || strcmp(bot, "random")) {
+            BatchPrintUsage();
+            return 1;
+        }
+    }
+    if (CLAContainsArg("--record", argc, argv)) {
+        cfg.record_dir = CLAGetArgValue("--record", argc, argv);
+        if (cfg.record_dir == NULL) {
+            BatchPrintUsage();
+            return 1;
+        }
+    }
+    if (cfg.nthreads == 0) {
+        cfg.nthreads = 1;
+    }
+    if (cfg.ngames == 0) {
+        BatchPrintUsage();
+        return 1;
+    }
+
+    u64 t_start = ReadSystemTimerMySec();
+    BatchStats stats = BatchRun(&cfg);
+    u64 t_end = ReadSystemTimerMySec();
+    f64 t_secs = MaxF64((t_end - t_start) / 1000000.0, 1e-6);
+
+    printf("games:       %llu on %u threads in %.3f s (seed %llu)\n", (unsigned long long) stats.games, cfg.nthreads, t_secs, (unsigned long long) cfg.seed);
+    printf("games/sec:   %.1f\n", stats.games / t_secs);
+    printf("pieces/sec:  %.1f\n", stats.pieces / t_secs);
+    printf("steps/sec:   %.1f\n", stats.steps / t_secs);
+    printf("pieces/game: mean %.2f, min %u, max %u\n", (f64) stats.pieces / stats.games, stats.pieces_min, stats.pieces_max);
+    printf("lines/game:  mean %.3f, min %u, max %u\n", (f64) stats.lines / stats.games, stats.lines_min, stats.lines_max);
+    printf("game length: mean %.1f s simulated\n", (f64) stats.steps * BATCH_DT / 1000 / stats.games);
+    printf("checksum:    %016llx\n", (unsigned long long) stats.checksum);
+
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include "lib/jg_baselayer.h"
+
+// game types and logics, no window needed
+#include "src/testris_types.h"
+#include "src/testris_blocks.h"
+#include "src/testris_lib.h"
+#include "src/testris_replay.h"
+
+
+//
+//  Replay player
+//
+//  Re-simulates recorded games as fast as possible and checks that each one
+//  ends on the recorded board. Arguments are replay files, or directories that
+//  are searched recursively for .trpl files.
+
+
+struct ReplayStats {
+    u64 replays;
+    u64 failed;
+    u64 steps;
+    u64 bytes;
+    f64 t_simulated; // [ms]
+};
+
+void ReplayRunFile(const char *filepath, ReplayStats *stats, u8 **buffer, u64 *capacity, bool verbose) {
+    u64 size = 0;
+    if (ReplayLoad(filepath, &size, buffer, capacity) == NULL) {
+        printf("FAIL %s: could not read\n", filepath);
+        stats->replays++;
+        stats->failed++;
+        return;
+    }
+
+    GameState gs = {};
+    ReplayInfo recorded = {};
+    bool ok = ReplayVerify(*buffer, size, &gs, &recorded);
+
+    stats->replays++;
+    stats->steps += recorded.steps;
+    stats->bytes += size;
+    stats->t_simulated += gs.t;
+
+    if (ok == false) {
+        stats->failed++;
+        printf("FAIL %s: seed %llu stream %llu, recorded pieces %u lines %u hash %016llx, got pieces %u lines %u hash %016llx\n",
+            filepath, (unsigned long long) recorded.seed, (unsigned long long) recorded.stream,
+            recorded.pieces, recorded.lines, (unsigned long long) recorded.hash,
+            gs.pieces, gs.lines, (unsigned long long) GameHash(&gs));
+    }
+    else if (verbose) {
+        printf("ok   %s: %llu steps, %u pieces, %u lines, %llu bytes\n",
+            filepath, (unsigned long long) recorded.steps, recorded.pieces, recorded.lines, (unsigned long long) size);
+    }
+}
+
+void ReplayPrintUsage() {
+    printf("usage: testris_replay [--verbose] FILE|DIR ...\n");
+}
+
+int main (int argc, char **argv) {
+    BaselayerAssertVersion(0, 2, 3);
+    StrInit();
+
+    if (argc < 2 || CLAContainsArg("--help", argc, argv)) {
+        ReplayPrintUsage();
+        return argc < 2;
+    }
+    bool verbose = CLAContainsArg("--verbose", argc, argv);
+
+    ReplayStats stats = {};
+    u8 *buffer = NULL;
+    u64 capacity = 0;
+
+    u64 t_start = ReadSystemTimerMySec();
+    for (s32 i = 1; i < argc; ++i) {
+        if (argv[i][0] == '-') {
+            continue;
+        }
+
+        StrLst *files = GetFilePaths_Rec(argv[i], NULL, NULL, "trpl", true);
+        if (files == NULL) {
+            printf("FAIL %s: no replays found\n", argv[i]);
+            stats.failed++;
+            continue;
+        }
+        for (StrLst *file = files->first; file != NULL; file = file->next) {
+            ReplayRunFile(file->str, &stats, &buffer, &capacity, verbose);
+        }
+    }
+    u64 t_end = ReadSystemTimerMySec();
+    f64 t_secs = MaxF64((t_end - t_start) / 1000000.0, 1e-6);
+
+    printf("replays:     %llu, %llu failed, in %.3f s\n", (unsigned long long) stats.replays, (unsigned long long) stats.failed, t_secs);
+    printf("replays/sec: %.1f\n", stats.replays / t_secs);
+    printf("steps/sec:   %.1f\n", stats.steps / t_secs);
+    printf("speedup:     %.0fx real time\n", stats.t_simulated / 1000 / t_secs);
+    printf("bytes/game:  %.1f\n", stats.replays ? (f64) stats.bytes / stats.replays : 0.0);
+
+    free(buffer);
+    return stats.failed != 0;
+}